@@ -138,6 +138,27 @@ _mcd_tp_channel_details_build_from_tp_chan (TpChannel *channel)
     return channel_array;
 }
 
+/*
+ * _mcd_tp_channel_details_build_from_tp_chans:
+ * @channels: a #GList of #TpChannel
+ *
+ * Returns: a #GPtrArray of Channel_Details, ready to be sent over D-Bus. Free
+ * with _mcd_tp_channel_details_free().
+ */
+GPtrArray *
+_mcd_tp_channel_details_build_from_tp_chans (const GList *channels)
+{
+    GPtrArray *channel_array;
+    const GList *list;
+
+    channel_array = g_ptr_array_sized_new (g_list_length ((GList *) channels));
+
+    for (list = channels; list != NULL; list = list->next)
+        _channel_details_array_append (channel_array, list->data);
+
+    return channel_array;
+}
+
 /*
  * _mcd_tp_channel_details_free:
  * @channels: a #GPtrArray of Channel_Details.
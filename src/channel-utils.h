@@ -38,6 +38,9 @@ GPtrArray *_mcd_tp_channel_details_build_from_list (const GList *channels);
 G_GNUC_INTERNAL
 GPtrArray *_mcd_tp_channel_details_build_from_tp_chan (TpChannel *channel);
 G_GNUC_INTERNAL
+GPtrArray *_mcd_tp_channel_details_build_from_tp_chans (
+    const GList *channels);
+G_GNUC_INTERNAL
 void _mcd_tp_channel_details_free (GPtrArray *channels);
 
 /* NULL-safe for @channel; @verb is for debug */
@@ -23,6 +23,8 @@
 
 #include "client-registry.h"
 
+#include <string.h>
+
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "mcd-debug.h"
@@ -54,6 +56,26 @@ struct _McdClientRegistryPrivate
    * owned gchar * well_known_name -> owned McdClientProxy */
   GHashTable *clients;
 
+  /* sets of clients that can play each role, so dispatching doesn't have to
+   * look at every client
+   * borrowed McdClientProxy -> the same borrowed McdClientProxy */
+  GHashTable *approvers;
+  GHashTable *handlers;
+  GHashTable *observers;
+
+  /* clients indexed by the unique name of the process that currently owns
+   * them; clients that are not running do not appear
+   * owned gchar * unique_name -> owned GPtrArray of borrowed McdClientProxy */
+  GHashTable *unique_names;
+
+  /* which Handler most recently took a channel of each kind, so we can
+   * prefer it next time
+   * owned gchar * affinity key -> owned gchar * well_known_name */
+  GHashTable *affinity;
+  /* the keys of affinity, least recently noted first
+   * borrowed gchar * affinity key */
+  GQueue *affinity_order;
+
   TpDBusDaemon *dbus_daemon;
 
   /* We don't want to start dispatching until startup has finished. This
@@ -67,6 +89,19 @@ struct _McdClientRegistryPrivate
    * */
   gsize startup_lock;
   gboolean startup_completed;
+
+  /* clients that are holding a startup lock
+   * borrowed McdClientProxy -> the same borrowed McdClientProxy */
+  GHashTable *blocking_startup;
+
+  /* Clients waiting to make the D-Bus calls needed to introspect them:
+   * those with a .client file need at most one call, so they go first.
+   * Queues of borrowed McdClientProxy. */
+  GQueue *introspect_quick;
+  GQueue *introspect_slow;
+  /* clients whose introspection calls are in progress
+   * borrowed McdClientProxy -> the same borrowed McdClientProxy */
+  GHashTable *introspecting;
 };
 
 static void
@@ -105,6 +140,158 @@ static void mcd_client_registry_ready_cb (McdClientProxy *client,
     McdClientRegistry *self);
 static void mcd_client_registry_gone_cb (McdClientProxy *client,
     McdClientRegistry *self);
+static void mcd_client_registry_introspection_wanted_cb (
+    McdClientProxy *client, McdClientRegistry *self);
+
+/* How many clients may be being introspected over D-Bus at once */
+#define MAX_CONCURRENT_INTROSPECTIONS 8
+
+static void
+mcd_client_registry_release_startup_lock (McdClientRegistry *self,
+    McdClientProxy *client)
+{
+  /* paired with the one in _mcd_client_registry_found_name */
+  if (g_hash_table_remove (self->priv->blocking_startup, client))
+    _mcd_client_registry_dec_startup_lock (self);
+}
+
+static void
+mcd_client_registry_introspect_more (McdClientRegistry *self)
+{
+  while (g_hash_table_size (self->priv->introspecting) <
+      MAX_CONCURRENT_INTROSPECTIONS)
+    {
+      McdClientProxy *client = g_queue_pop_head (self->priv->introspect_quick);
+
+      if (client == NULL)
+        client = g_queue_pop_head (self->priv->introspect_slow);
+
+      if (client == NULL)
+        return;
+
+      DEBUG ("introspecting %s (%u waiting)", tp_proxy_get_bus_name (client),
+          g_queue_get_length (self->priv->introspect_quick) +
+          g_queue_get_length (self->priv->introspect_slow));
+
+      g_hash_table_add (self->priv->introspecting, client);
+      _mcd_client_proxy_introspect_on_bus (client);
+    }
+}
+
+/* @client is ready or gone: either way, it no longer needs to be
+ * introspected */
+static void
+mcd_client_registry_introspection_done (McdClientRegistry *self,
+    McdClientProxy *client)
+{
+  g_queue_remove (self->priv->introspect_quick, client);
+  g_queue_remove (self->priv->introspect_slow, client);
+
+  if (g_hash_table_remove (self->priv->introspecting, client))
+    mcd_client_registry_introspect_more (self);
+}
+
+static GHashTable *
+_mcd_client_registry_get_role_set (McdClientRegistry *self,
+    McdClientRoles role)
+{
+  switch (role)
+    {
+    case MCD_CLIENT_ROLE_APPROVER:
+      return self->priv->approvers;
+
+    case MCD_CLIENT_ROLE_HANDLER:
+      return self->priv->handlers;
+
+    case MCD_CLIENT_ROLE_OBSERVER:
+      return self->priv->observers;
+
+    default:
+      g_return_val_if_reached (NULL);
+    }
+}
+
+static void
+_mcd_client_registry_set_roles (McdClientRegistry *self,
+    McdClientProxy *client,
+    McdClientRoles roles)
+{
+  static const McdClientRoles all_roles[] = { MCD_CLIENT_ROLE_APPROVER,
+      MCD_CLIENT_ROLE_HANDLER, MCD_CLIENT_ROLE_OBSERVER };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (all_roles); i++)
+    {
+      GHashTable *set = _mcd_client_registry_get_role_set (self,
+          all_roles[i]);
+
+      if (roles & all_roles[i])
+        g_hash_table_add (set, client);
+      else
+        g_hash_table_remove (set, client);
+    }
+}
+
+static void
+_mcd_client_registry_index_unique_name (McdClientRegistry *self,
+    McdClientProxy *client,
+    const gchar *unique_name)
+{
+  GPtrArray *same_process;
+
+  if (tp_str_empty (unique_name))
+    return;
+
+  same_process = g_hash_table_lookup (self->priv->unique_names, unique_name);
+
+  if (same_process == NULL)
+    {
+      same_process = g_ptr_array_new ();
+      g_hash_table_insert (self->priv->unique_names, g_strdup (unique_name),
+          same_process);
+    }
+
+  g_ptr_array_add (same_process, client);
+}
+
+static void
+_mcd_client_registry_unindex_unique_name (McdClientRegistry *self,
+    McdClientProxy *client,
+    const gchar *unique_name)
+{
+  GPtrArray *same_process;
+
+  if (tp_str_empty (unique_name))
+    return;
+
+  same_process = g_hash_table_lookup (self->priv->unique_names, unique_name);
+
+  if (same_process == NULL)
+    return;
+
+  g_ptr_array_remove_fast (same_process, client);
+
+  if (same_process->len == 0)
+    g_hash_table_remove (self->priv->unique_names, unique_name);
+}
+
+static void
+mcd_client_registry_unique_name_changed_cb (McdClientProxy *client,
+    const gchar *old_unique_name,
+    McdClientRegistry *self)
+{
+  _mcd_client_registry_unindex_unique_name (self, client, old_unique_name);
+  _mcd_client_registry_index_unique_name (self, client,
+      _mcd_client_proxy_get_unique_name (client));
+}
+
+static void
+mcd_client_registry_roles_changed_cb (McdClientProxy *client,
+    McdClientRegistry *self)
+{
+  _mcd_client_registry_set_roles (self, client,
+      _mcd_client_proxy_get_roles (client));
+}
 
 static void
 _mcd_client_registry_found_name (McdClientRegistry *self,
@@ -156,9 +343,14 @@ _mcd_client_registry_found_name (McdClientRegistry *self,
   g_hash_table_insert (self->priv->clients, g_strdup (well_known_name),
       client);
 
-  /* paired with one in mcd_client_registry_ready_cb, when the
-   * McdClientProxy is ready */
+  /* paired with one in mcd_client_registry_release_startup_lock, usually
+   * when the McdClientProxy is ready */
   _mcd_client_registry_inc_startup_lock (self);
+  g_hash_table_add (self->priv->blocking_startup, client);
+
+  g_signal_connect (client, "introspection-wanted",
+                    G_CALLBACK (mcd_client_registry_introspection_wanted_cb),
+                    self);
 
   g_signal_connect (client, "ready",
                     G_CALLBACK (mcd_client_registry_ready_cb),
@@ -168,6 +360,17 @@ _mcd_client_registry_found_name (McdClientRegistry *self,
                     G_CALLBACK (mcd_client_registry_gone_cb),
                     self);
 
+  g_signal_connect (client, "roles-changed",
+                    G_CALLBACK (mcd_client_registry_roles_changed_cb),
+                    self);
+  mcd_client_registry_roles_changed_cb (client, self);
+
+  g_signal_connect (client, "unique-name-changed",
+                    G_CALLBACK (mcd_client_registry_unique_name_changed_cb),
+                    self);
+  _mcd_client_registry_index_unique_name (self, client,
+      _mcd_client_proxy_get_unique_name (client));
+
   g_signal_emit (self, signals[S_CLIENT_ADDED], 0, client);
 }
 
@@ -186,6 +389,12 @@ mcd_client_registry_disconnect_client_signals (gpointer k G_GNUC_UNUSED,
 {
   g_signal_handlers_disconnect_by_func (v, mcd_client_registry_ready_cb, data);
   g_signal_handlers_disconnect_by_func (v, mcd_client_registry_gone_cb, data);
+  g_signal_handlers_disconnect_by_func (v,
+      mcd_client_registry_introspection_wanted_cb, data);
+  g_signal_handlers_disconnect_by_func (v,
+      mcd_client_registry_roles_changed_cb, data);
+  g_signal_handlers_disconnect_by_func (v,
+      mcd_client_registry_unique_name_changed_cb, data);
 
   if (!_mcd_client_proxy_is_ready (v))
     {
@@ -209,6 +418,9 @@ _mcd_client_registry_remove (McdClientRegistry *self,
     {
       mcd_client_registry_disconnect_client_signals (NULL,
           client, self);
+      _mcd_client_registry_set_roles (self, client, MCD_CLIENT_ROLE_NONE);
+      _mcd_client_registry_unindex_unique_name (self, client,
+          _mcd_client_proxy_get_unique_name (client));
     }
 
   g_hash_table_remove (self->priv->clients, well_known_name);
@@ -221,6 +433,31 @@ void _mcd_client_registry_init_hash_iter (McdClientRegistry *self,
   g_hash_table_iter_init (iter, self->priv->clients);
 }
 
+/*
+ * _mcd_client_registry_init_role_iter:
+ * @self: the client registry
+ * @role: exactly one of the #McdClientRoles
+ * @iter: an iterator to initialize
+ *
+ * Initialize @iter to iterate over the clients that implement @role. Both
+ * the keys and the values of the iterator are borrowed #McdClientProxy
+ * objects.
+ */
+void
+_mcd_client_registry_init_role_iter (McdClientRegistry *self,
+    McdClientRoles role,
+    GHashTableIter *iter)
+{
+  GHashTable *set;
+
+  g_return_if_fail (MCD_IS_CLIENT_REGISTRY (self));
+
+  set = _mcd_client_registry_get_role_set (self, role);
+  g_return_if_fail (set != NULL);
+
+  g_hash_table_iter_init (iter, set);
+}
+
 static void
 _mcd_client_registry_init (McdClientRegistry *self)
 {
@@ -232,6 +469,18 @@ _mcd_client_registry_init (McdClientRegistry *self)
   self->priv->startup_lock = 1;
   self->priv->clients = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
       g_object_unref);
+  self->priv->approvers = g_hash_table_new (NULL, NULL);
+  self->priv->handlers = g_hash_table_new (NULL, NULL);
+  self->priv->observers = g_hash_table_new (NULL, NULL);
+  self->priv->unique_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_ptr_array_unref);
+  self->priv->blocking_startup = g_hash_table_new (NULL, NULL);
+  self->priv->introspect_quick = g_queue_new ();
+  self->priv->introspect_slow = g_queue_new ();
+  self->priv->introspecting = g_hash_table_new (NULL, NULL);
+  self->priv->affinity = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  self->priv->affinity_order = g_queue_new ();
 }
 
 static void
@@ -459,12 +708,27 @@ mcd_client_registry_dispose (GObject *object)
 
   if (self->priv->clients != NULL)
     {
+      /* don't start introspecting anything else while we let go */
+      g_queue_clear (self->priv->introspect_quick);
+      g_queue_clear (self->priv->introspect_slow);
+
       g_hash_table_foreach (self->priv->clients,
           mcd_client_registry_disconnect_client_signals, self);
 
     }
 
+  /* these borrow the clients, so must go first */
+  tp_clear_pointer (&self->priv->blocking_startup, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->introspect_quick, g_queue_free);
+  tp_clear_pointer (&self->priv->introspect_slow, g_queue_free);
+  tp_clear_pointer (&self->priv->introspecting, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->approvers, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->handlers, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->observers, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->unique_names, g_hash_table_unref);
   tp_clear_pointer (&self->priv->clients, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->affinity_order, g_queue_free);
+  tp_clear_pointer (&self->priv->affinity, g_hash_table_unref);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -519,8 +783,27 @@ mcd_client_registry_ready_cb (McdClientProxy *client,
   g_signal_handlers_disconnect_by_func (client,
       mcd_client_registry_ready_cb, self);
 
-  /* paired with the one in _mcd_client_registry_found_name */
-  _mcd_client_registry_dec_startup_lock (self);
+  mcd_client_registry_release_startup_lock (self, client);
+  mcd_client_registry_introspection_done (self, client);
+}
+
+static void
+mcd_client_registry_introspection_wanted_cb (McdClientProxy *client,
+    McdClientRegistry *self)
+{
+  if (_mcd_client_proxy_has_client_file (client))
+    {
+      g_queue_push_tail (self->priv->introspect_quick, client);
+    }
+  else
+    {
+      /* This still holds the startup lock until it's ready: if it's not
+       * running, it's activated to find out what it can do, and until
+       * then we can't tell whether it should be handling channels. */
+      g_queue_push_tail (self->priv->introspect_slow, client);
+    }
+
+  mcd_client_registry_introspect_more (self);
 }
 
 static void
@@ -530,6 +813,14 @@ mcd_client_registry_gone_cb (McdClientProxy *client,
   _mcd_client_registry_remove (self, tp_proxy_get_bus_name (client));
 }
 
+/*
+ * _mcd_client_registry_dup_client_caps:
+ * @self: the client registry
+ *
+ * Returns: (transfer container): an array of HandlerCapabilities structs,
+ *  one per client, borrowed from the clients; use it before returning to
+ *  the main loop
+ */
 GPtrArray *
 _mcd_client_registry_dup_client_caps (McdClientRegistry *self)
 {
@@ -546,7 +837,7 @@ _mcd_client_registry_dup_client_caps (McdClientRegistry *self)
   while (g_hash_table_iter_next (&iter, NULL, &p))
     {
       g_ptr_array_add (vas,
-          _mcd_client_proxy_dup_handler_capabilities (p));
+          _mcd_client_proxy_get_handler_capabilities (p));
     }
 
   return vas;
@@ -559,10 +850,152 @@ _mcd_client_registry_is_ready (McdClientRegistry *self)
   return self->priv->startup_completed;
 }
 
+/* Don't let a long-running MC accumulate an unbounded number of
+ * account/channel combinations; the ones we forget are those that have gone
+ * longest without a channel, which go back to being chosen by filter quality
+ * alone */
+#define MAX_AFFINITY_ENTRIES 256
+
+/*
+ * affinity_key_new:
+ * @account_path: the account's object path
+ * @props: the immutable properties of a channel, or the properties of a
+ *  channel request, as a{sv}
+ *
+ * Returns: a key identifying channels "like" @props on that account: the
+ *  same channel type, target handle type and, for targets of the form
+ *  user@domain, the same domain; or %NULL if @props has no channel type
+ */
+static gchar *
+affinity_key_new (const gchar *account_path,
+    GVariant *props)
+{
+  const gchar *channel_type = NULL;
+  const gchar *target_id = NULL;
+  const gchar *domain = NULL;
+  guint32 handle_type = TP_HANDLE_TYPE_NONE;
+
+  if (account_path == NULL || props == NULL)
+    return NULL;
+
+  if (!g_variant_lookup (props, TP_PROP_CHANNEL_CHANNEL_TYPE, "&s",
+        &channel_type))
+    return NULL;
+
+  g_variant_lookup (props, TP_PROP_CHANNEL_TARGET_HANDLE_TYPE, "u",
+      &handle_type);
+
+  if (g_variant_lookup (props, TP_PROP_CHANNEL_TARGET_ID, "&s", &target_id))
+    domain = strrchr (target_id, '@');
+
+  return g_strdup_printf ("%s\n%s\n%u\n%s", account_path, channel_type,
+      handle_type, domain != NULL ? domain + 1 : "");
+}
+
+/*
+ * _mcd_client_registry_note_handled:
+ * @self: the client registry
+ * @account_path: the account to which the channel belongs
+ * @props: the channel's immutable properties
+ * @well_known_name: the Handler that successfully handled it
+ *
+ * Remember that @well_known_name accepted a channel like this one, so that
+ * it is preferred over equally good Handlers for similar channels and
+ * requests in future.
+ */
+void
+_mcd_client_registry_note_handled (McdClientRegistry *self,
+    const gchar *account_path,
+    GVariant *props,
+    const gchar *well_known_name)
+{
+  gchar *key;
+  gpointer previous_key;
+  gpointer previous;
+
+  g_return_if_fail (MCD_IS_CLIENT_REGISTRY (self));
+  g_return_if_fail (well_known_name != NULL);
+
+  key = affinity_key_new (account_path, props);
+
+  if (key == NULL)
+    return;
+
+  if (g_hash_table_lookup_extended (self->priv->affinity, key,
+        &previous_key, &previous))
+    {
+      /* move it to the most recently used end; the table keeps its own
+       * copy of the key, so the queue's pointer stays valid */
+      g_queue_remove (self->priv->affinity_order, previous_key);
+      g_queue_push_tail (self->priv->affinity_order, previous_key);
+
+      if (tp_strdiff (previous, well_known_name))
+        {
+          DEBUG ("%s is now the usual handler for its channels on %s",
+              well_known_name, account_path);
+          g_hash_table_insert (self->priv->affinity, key,
+              g_strdup (well_known_name));
+        }
+      else
+        {
+          g_free (key);
+        }
+
+      return;
+    }
+
+  while (g_hash_table_size (self->priv->affinity) >= MAX_AFFINITY_ENTRIES)
+    {
+      gchar *oldest = g_queue_pop_head (self->priv->affinity_order);
+
+      DEBUG ("too many remembered handlers, forgetting %s",
+          (const gchar *) g_hash_table_lookup (self->priv->affinity, oldest));
+      g_hash_table_remove (self->priv->affinity, oldest);
+    }
+
+  DEBUG ("%s is now the usual handler for its channels on %s",
+      well_known_name, account_path);
+  g_hash_table_insert (self->priv->affinity, key,
+      g_strdup (well_known_name));
+  g_queue_push_tail (self->priv->affinity_order, key);
+}
+
+/*
+ * _mcd_client_registry_get_usual_handler:
+ * @self: the client registry
+ * @account_path: an account
+ * @props: a channel's immutable properties, or a channel request's
+ *  requested properties
+ *
+ * Returns: (transfer none): the well-known name of the Handler that most
+ *  recently handled a channel like @props on @account_path, or %NULL
+ */
+const gchar *
+_mcd_client_registry_get_usual_handler (McdClientRegistry *self,
+    const gchar *account_path,
+    GVariant *props)
+{
+  gchar *key;
+  const gchar *ret;
+
+  g_return_val_if_fail (MCD_IS_CLIENT_REGISTRY (self), NULL);
+
+  key = affinity_key_new (account_path, props);
+
+  if (key == NULL)
+    return NULL;
+
+  ret = g_hash_table_lookup (self->priv->affinity, key);
+  g_free (key);
+  return ret;
+}
+
 typedef struct
 {
     McdClientProxy *client;
     gboolean bypass;
+    gboolean cooling_down;
+    gboolean usual;
     gsize quality;
 } PossibleHandler;
 
@@ -587,6 +1020,18 @@ possible_handler_cmp (gconstpointer a_,
       return -1;
     }
 
+  /* Among handlers that would make the same decision about approval, one
+   * that has been failing recently is worse than any that hasn't */
+  if (a->cooling_down)
+    {
+      if (!b->cooling_down)
+        return -1;
+    }
+  else if (b->cooling_down)
+    {
+      return 1;
+    }
+
   if (a->quality < b->quality)
     {
       return -1;
@@ -597,75 +1042,126 @@ possible_handler_cmp (gconstpointer a_,
       return 1;
     }
 
-  return 0;
+  /* All else being equal, stick with what worked last time */
+  if (a->usual != b->usual)
+    return a->usual ? 1 : -1;
+
+  /* Otherwise, don't let the choice depend on the order in which the
+   * handlers set happens to be iterated: the client whose well-known name
+   * sorts first is better */
+  return strcmp (tp_proxy_get_bus_name (b->client),
+      tp_proxy_get_bus_name (a->client));
+}
+
+static GList *
+possible_handlers_consider (GList *handlers,
+    McdClientProxy *client,
+    GVariant *request_props,
+    TpChannel *channel,
+    const gchar *usual_handler)
+{
+  gsize quality;
+
+  if (channel == NULL)
+    {
+      /* We don't know the channel's properties (the next part will not
+       * execute), so we must work out the quality of match from the
+       * channel request. We can assume that the request will return one
+       * channel, with the requested properties, plus Requested == TRUE.
+       */
+      g_assert (request_props != NULL);
+      quality = _mcd_client_match_filters (request_props,
+          _mcd_client_proxy_get_handler_filters (client), TRUE);
+    }
+  else
+    {
+      GVariant *properties;
+
+      g_assert (TP_IS_CHANNEL (channel));
+      properties = tp_channel_dup_immutable_properties (channel);
+      quality = _mcd_client_match_filters (properties,
+          _mcd_client_proxy_get_handler_filters (client), FALSE);
+      g_variant_unref (properties);
+    }
+
+  if (quality > 0)
+    {
+      PossibleHandler *ph = g_slice_new0 (PossibleHandler);
+
+      ph->client = client;
+      ph->bypass = _mcd_client_proxy_get_bypass_approval (client);
+      ph->cooling_down = _mcd_client_proxy_is_cooling_down (client);
+      ph->usual = !tp_strdiff (usual_handler,
+          tp_proxy_get_bus_name (client));
+      ph->quality = quality;
+
+      handlers = g_list_prepend (handlers, ph);
+    }
+
+  return handlers;
 }
 
 GList *
 _mcd_client_registry_list_possible_handlers (McdClientRegistry *self,
     const gchar *preferred_handler,
+    const gchar *account_path,
     GVariant *request_props,
     TpChannel *channel,
     const gchar *must_have_unique_name)
 {
   GList *handlers = NULL;
   GList *handlers_iter;
-  GHashTableIter client_iter;
-  gpointer client_p;
+  const gchar *usual_handler = NULL;
 
-  _mcd_client_registry_init_hash_iter (self, &client_iter);
+  if (channel != NULL)
+    {
+      GVariant *properties = tp_channel_dup_immutable_properties (channel);
 
-  while (g_hash_table_iter_next (&client_iter, NULL, &client_p))
+      usual_handler = _mcd_client_registry_get_usual_handler (self,
+          account_path, properties);
+      g_variant_unref (properties);
+    }
+  else
     {
-      McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
-      gsize quality;
+      usual_handler = _mcd_client_registry_get_usual_handler (self,
+          account_path, request_props);
+    }
 
-      if (must_have_unique_name != NULL &&
-          tp_strdiff (must_have_unique_name,
-            _mcd_client_proxy_get_unique_name (client)))
-        {
-          /* we're trying to redispatch to an existing handler, and this is
-           * not it */
-          continue;
-        }
+  if (must_have_unique_name != NULL)
+    {
+      /* we're trying to redispatch to an existing handler, so only the
+       * clients owned by that process are interesting */
+      GPtrArray *same_process = g_hash_table_lookup (
+          self->priv->unique_names, must_have_unique_name);
+      guint i;
 
-      if (!tp_proxy_has_interface_by_id (client,
-            TP_IFACE_QUARK_CLIENT_HANDLER))
+      for (i = 0; same_process != NULL && i < same_process->len; i++)
         {
-            /* not a handler at all */
-            continue;
-        }
+          McdClientProxy *client = g_ptr_array_index (same_process, i);
 
-      if (channel == NULL)
-        {
-          /* We don't know the channel's properties (the next part will not
-           * execute), so we must work out the quality of match from the
-           * channel request. We can assume that the request will return one
-           * channel, with the requested properties, plus Requested == TRUE.
-           */
-          g_assert (request_props != NULL);
-          quality = _mcd_client_match_filters (request_props,
-              _mcd_client_proxy_get_handler_filters (client), TRUE);
-        }
-      else
-        {
-          GVariant *properties;
+          if (!g_hash_table_contains (self->priv->handlers, client))
+            {
+              /* not a handler at all */
+              continue;
+            }
 
-          g_assert (TP_IS_CHANNEL (channel));
-          properties = tp_channel_dup_immutable_properties (channel);
-          quality = _mcd_client_match_filters (properties,
-              _mcd_client_proxy_get_handler_filters (client), FALSE);
-          g_variant_unref (properties);
+          handlers = possible_handlers_consider (handlers, client,
+              request_props, channel, usual_handler);
         }
+    }
+  else
+    {
+      GHashTableIter client_iter;
+      gpointer client_p;
 
-      if (quality > 0)
-        {
-          PossibleHandler *ph = g_slice_new0 (PossibleHandler);
-
-          ph->client = client;
-          ph->bypass = _mcd_client_proxy_get_bypass_approval (client);
-          ph->quality = quality;
+      _mcd_client_registry_init_role_iter (self, MCD_CLIENT_ROLE_HANDLER,
+          &client_iter);
 
-          handlers = g_list_prepend (handlers, ph);
+      while (g_hash_table_iter_next (&client_iter, NULL, &client_p))
+        {
+          handlers = possible_handlers_consider (handlers,
+              MCD_CLIENT_PROXY (client_p), request_props, channel,
+              usual_handler);
         }
     }
 
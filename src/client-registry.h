@@ -79,12 +79,20 @@ G_GNUC_INTERNAL gboolean _mcd_client_registry_is_ready (
 
 G_GNUC_INTERNAL void _mcd_client_registry_init_hash_iter (
     McdClientRegistry *self, GHashTableIter *iter);
+G_GNUC_INTERNAL void _mcd_client_registry_init_role_iter (
+    McdClientRegistry *self, McdClientRoles role, GHashTableIter *iter);
 
 G_GNUC_INTERNAL GList *_mcd_client_registry_list_possible_handlers (
     McdClientRegistry *self, const gchar *preferred_handler,
-    GVariant *request_props, TpChannel *channel,
+    const gchar *account_path, GVariant *request_props, TpChannel *channel,
     const gchar *must_have_unique_name);
 
+G_GNUC_INTERNAL void _mcd_client_registry_note_handled (
+    McdClientRegistry *self, const gchar *account_path, GVariant *props,
+    const gchar *well_known_name);
+G_GNUC_INTERNAL const gchar *_mcd_client_registry_get_usual_handler (
+    McdClientRegistry *self, const gchar *account_path, GVariant *props);
+
 G_END_DECLS
 
 #endif
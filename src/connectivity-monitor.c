@@ -26,6 +26,7 @@
 #include "connectivity-monitor.h"
 
 #include <errno.h>
+#include <stdlib.h>
 
 #ifdef HAVE_GIO_UNIX
 #include <gio/gunixfdlist.h>
@@ -79,6 +80,17 @@ typedef enum {
     CONNECTIVITY_RUNNING = (1 << 3)
 } Connectivity;
 
+/* The states that come from the network, and can flap */
+#define NETWORK_STATES (CONNECTIVITY_UP | CONNECTIVITY_STABLE)
+
+/* If the network goes away, wait this long before telling the accounts, in
+ * case it comes straight back (overridden by MC_CONNECTIVITY_HYSTERESIS) */
+#define DEFAULT_HYSTERESIS_MS 1000
+/* After the network comes or goes, wait at least this long before telling
+ * the accounts that it has changed again (overridden by
+ * MC_CONNECTIVITY_MIN_INTERVAL) */
+#define DEFAULT_MIN_INTERVAL_MS 2000
+
 struct _McdConnectivityMonitorPrivate {
   GNetworkMonitor *network_monitor;
 
@@ -99,6 +111,23 @@ struct _McdConnectivityMonitorPrivate {
 
   Connectivity connectivity;
   gboolean use_conn;
+
+  /* The NETWORK_STATES as most recently reported, which might not have
+   * made it into connectivity yet */
+  Connectivity network;
+  /* FALSE while we're finding out the initial state */
+  gboolean debounce;
+  guint hysteresis_ms;
+  guint min_interval_ms;
+  /* Applies network to connectivity when it has settled down, or 0 */
+  guint network_source;
+  /* When the network last made us go online or offline, or 0 */
+  gint64 last_network_transition;
+  /* Number of times the network went away and came back (or vice versa)
+   * before we told anyone */
+  guint n_suppressed;
+  /* Number of network changes that were delayed by min_interval_ms */
+  guint n_rate_limited;
 };
 
 enum {
@@ -180,6 +209,113 @@ connectivity_monitor_remove_states (
   connectivity_monitor_change_states (self, CONNECTIVITY_NONE, clear, inhibit);
 }
 
+static void
+connectivity_monitor_apply_network (McdConnectivityMonitor *self)
+{
+  McdConnectivityMonitorPrivate *priv = self->priv;
+  gboolean was_connected = is_connected (priv->connectivity);
+
+  connectivity_monitor_change_states (self, priv->network,
+      NETWORK_STATES & ~priv->network, NULL);
+
+  if (is_connected (priv->connectivity) != was_connected)
+    priv->last_network_transition = g_get_monotonic_time ();
+}
+
+static gboolean
+connectivity_monitor_network_settled_cb (gpointer user_data)
+{
+  McdConnectivityMonitor *self = MCD_CONNECTIVITY_MONITOR (user_data);
+
+  DEBUG ("network state has settled down");
+  self->priv->network_source = 0;
+  connectivity_monitor_apply_network (self);
+  return FALSE;
+}
+
+/*
+ * Record that the network has changed, but don't act on it until it has
+ * settled down: flaky wireless networks can go away and come back several
+ * times a second, and tearing down and re-establishing every connection
+ * each time would be worse than not noticing.
+ */
+static void
+connectivity_monitor_change_network (
+    McdConnectivityMonitor *self,
+    Connectivity set,
+    Connectivity clear)
+{
+  McdConnectivityMonitorPrivate *priv = self->priv;
+  Connectivity wanted;
+  guint delay_ms = 0;
+
+  priv->network = ((priv->network | set) & (~clear));
+  wanted = ((priv->connectivity & ~NETWORK_STATES) | priv->network);
+
+  if (wanted == priv->connectivity)
+    {
+      if (priv->network_source != 0)
+        {
+          priv->n_suppressed++;
+          DEBUG ("network went back to how it was; ignoring the change "
+              "(%u flaps suppressed so far)", priv->n_suppressed);
+          g_source_remove (priv->network_source);
+          priv->network_source = 0;
+        }
+
+      return;
+    }
+
+  /* it'll use the latest state when it fires */
+  if (priv->network_source != 0)
+    return;
+
+  if (priv->debounce &&
+      is_connected (wanted) != is_connected (priv->connectivity))
+    {
+      if (!is_connected (wanted))
+        delay_ms = priv->hysteresis_ms;
+
+      if (priv->last_network_transition != 0)
+        {
+          gint64 elapsed_ms = (g_get_monotonic_time () -
+              priv->last_network_transition) / 1000;
+
+          if (elapsed_ms < priv->min_interval_ms)
+            {
+              priv->n_rate_limited++;
+              delay_ms = MAX (delay_ms, priv->min_interval_ms - elapsed_ms);
+              DEBUG ("network changed again too soon; waiting %u ms "
+                  "(%u changes delayed so far)", delay_ms,
+                  priv->n_rate_limited);
+            }
+        }
+    }
+
+  if (delay_ms == 0)
+    {
+      connectivity_monitor_apply_network (self);
+    }
+  else
+    {
+      DEBUG ("waiting %u ms for the network to settle down", delay_ms);
+      priv->network_source = g_timeout_add (delay_ms,
+          connectivity_monitor_network_settled_cb, self);
+    }
+}
+
+static guint
+get_timeout_from_env (const gchar *name,
+    guint default_ms)
+{
+  const gchar *value = g_getenv (name);
+
+  if (value == NULL)
+    return default_ms;
+
+  return MAX (0, atoi (value));
+}
+
 #ifdef HAVE_NM
 
 static void
@@ -203,21 +339,21 @@ connectivity_monitor_nm_state_change_cb (NMClient *client,
     {
       DEBUG ("New NetworkManager network state %d (unstable state)", state);
 
-      connectivity_monitor_remove_states (connectivity_monitor,
-          CONNECTIVITY_STABLE, NULL);
+      connectivity_monitor_change_network (connectivity_monitor,
+          CONNECTIVITY_NONE, CONNECTIVITY_STABLE);
     }
   else if (state == NM_STATE_DISCONNECTED)
     {
       DEBUG ("New NetworkManager network state %d (disconnected)", state);
 
-      connectivity_monitor_remove_states (connectivity_monitor,
-          CONNECTIVITY_UP|CONNECTIVITY_STABLE, NULL);
+      connectivity_monitor_change_network (connectivity_monitor,
+          CONNECTIVITY_NONE, CONNECTIVITY_UP|CONNECTIVITY_STABLE);
     }
   else
     {
       DEBUG ("New NetworkManager network state %d (stable state)", state);
-      connectivity_monitor_add_states (connectivity_monitor,
-          CONNECTIVITY_STABLE, NULL);
+      connectivity_monitor_change_network (connectivity_monitor,
+          CONNECTIVITY_STABLE, CONNECTIVITY_NONE);
     }
 }
 #endif
@@ -238,15 +374,15 @@ connectivity_monitor_network_changed (GNetworkMonitor *monitor,
     {
       DEBUG ("GNetworkMonitor (%s) says we are at least partially online",
           G_OBJECT_TYPE_NAME (monitor));
-      connectivity_monitor_add_states (connectivity_monitor, CONNECTIVITY_UP,
-          NULL);
+      connectivity_monitor_change_network (connectivity_monitor,
+          CONNECTIVITY_UP, CONNECTIVITY_NONE);
     }
   else
     {
       DEBUG ("GNetworkMonitor (%s) says we are offline",
           G_OBJECT_TYPE_NAME (monitor));
-      connectivity_monitor_remove_states (connectivity_monitor,
-          CONNECTIVITY_UP, NULL);
+      connectivity_monitor_change_network (connectivity_monitor,
+          CONNECTIVITY_NONE, CONNECTIVITY_UP);
     }
 }
 
@@ -463,6 +599,11 @@ mcd_connectivity_monitor_init (McdConnectivityMonitor *connectivity_monitor)
   /* Initially, assume everything is good. */
   priv->connectivity = CONNECTIVITY_AWAKE | CONNECTIVITY_STABLE |
     CONNECTIVITY_UP | CONNECTIVITY_RUNNING;
+  priv->network = NETWORK_STATES;
+  priv->hysteresis_ms = get_timeout_from_env ("MC_CONNECTIVITY_HYSTERESIS",
+      DEFAULT_HYSTERESIS_MS);
+  priv->min_interval_ms = get_timeout_from_env (
+      "MC_CONNECTIVITY_MIN_INTERVAL", DEFAULT_MIN_INTERVAL_MS);
 
   priv->network_monitor = g_network_monitor_get_default ();
 
@@ -501,6 +642,9 @@ mcd_connectivity_monitor_init (McdConnectivityMonitor *connectivity_monitor)
   }
 #endif
 
+  /* Now that we know where we stand, changes are real changes */
+  priv->debounce = TRUE;
+
   g_bus_get (G_BUS_TYPE_SYSTEM, NULL, got_system_bus_cb,
       g_object_ref (connectivity_monitor));
 }
@@ -552,6 +696,12 @@ connectivity_monitor_dispose (GObject *object)
 {
   McdConnectivityMonitor *self = MCD_CONNECTIVITY_MONITOR (object);
 
+  if (self->priv->network_source != 0)
+    {
+      g_source_remove (self->priv->network_source);
+      self->priv->network_source = 0;
+    }
+
   g_clear_object (&self->priv->network_monitor);
 
 #ifdef ENABLE_CONN_SETTING
@@ -714,9 +864,16 @@ mcd_connectivity_monitor_set_use_conn (McdConnectivityMonitor *connectivity_moni
     }
   else
     {
-      /* !use_conn basically means "always assume it's stable and up". */
-      connectivity_monitor_add_states (connectivity_monitor,
-          CONNECTIVITY_STABLE|CONNECTIVITY_UP, NULL);
+      /* !use_conn basically means "always assume it's stable and up",
+       * starting right now. */
+      if (priv->network_source != 0)
+        {
+          g_source_remove (priv->network_source);
+          priv->network_source = 0;
+        }
+
+      priv->network = NETWORK_STATES;
+      connectivity_monitor_apply_network (connectivity_monitor);
     }
 
   g_object_notify (G_OBJECT (connectivity_monitor), "use-conn");
@@ -88,6 +88,25 @@ struct _McdAccountManagerPrivate
 
     gchar *account_connections_dir;  /* directory for temporary file */
     gchar *account_connections_file; /* in account_connections_dir */
+    /* account name => connection path, as recorded in
+     * account_connections_file; both owned */
+    GHashTable *stored_connections;
+    /* account_connections_file opened for appending, or NULL if it needs
+     * rewriting first */
+    FILE *account_connections_log;
+    /* number of records in account_connections_file */
+    guint account_connections_records;
+
+    /* Recovery of connections that were running before we started:
+     * ref'd McdConnection, attached to their accounts but not yet being
+     * introspected */
+    GQueue recovery_queue;
+    /* owned RecoveringConnection */
+    GList *recovering;
+    guint recovery_total;
+    guint recovery_finished;
+    /* when recovery started, or 0 if not recovering */
+    gint64 recovery_started;
 
     gboolean dbus_registered;
     /* 1 per thing we need to do before we can take the AccountManager name */
@@ -429,22 +448,188 @@ deleted_cb (McdStorage *storage,
     }
 }
 
-static gboolean
-get_account_connection (const gchar *file_contents, const gchar *path,
-                        gchar **p_bus_name, gchar **p_account_name)
+/*
+ * The account connections file remembers which connection each account was
+ * using, so that we can pick them up again if we are restarted. Version 2
+ * is a header line followed by a log of changes, one per line, with
+ * strings written as <length>:<bytes>:
+ *
+ *   # Mission Control account connections 2
+ *   +<object path><bus name><account name>
+ *   -<account name>
+ *
+ * "+" records that the account is using the given connection, replacing
+ * any earlier record for that account, and "-" records that it is no
+ * longer using any connection. Changes are appended as they happen, and
+ * the file is atomically replaced by a compacted copy when the log gets
+ * long. If we crash in the middle of appending a change, the truncated
+ * record at the end of the file is ignored.
+ *
+ * Version 1 was the same, but with only "+" records and no "+" prefix.
+ * Older versions of Mission Control wrote the three strings separated by
+ * tabs, with no header; we can still read both.
+ */
+#define ACCOUNT_CONNECTIONS_HEADER_V1 \
+    "# Mission Control account connections 1\n"
+#define ACCOUNT_CONNECTIONS_HEADER \
+    "# Mission Control account connections 2\n"
+
+/* Don't compact the file until it has this many records... */
+#define ACCOUNT_CONNECTIONS_COMPACT_MIN 64
+/* ... and at least this many times as many as there are connections */
+#define ACCOUNT_CONNECTIONS_COMPACT_RATIO 2
+
+typedef struct {
+    gchar *bus_name;
+    gchar *account_name;
+} AccountConnection;
+
+static void
+account_connection_free (gpointer p)
 {
-    const gchar *line, *tab1, *tab2, *endline;
-    const gchar *connection_path, *bus_name, *account_name;
-    size_t len;
+    AccountConnection *ac = p;
+
+    g_free (ac->bus_name);
+    g_free (ac->account_name);
+    g_slice_free (AccountConnection, ac);
+}
+
+static AccountConnection *
+account_connections_add (GHashTable *connections,
+                         gchar *connection_path,
+                         gchar *bus_name,
+                         gchar *account_name)
+{
+    AccountConnection *ac = g_slice_new (AccountConnection);
+
+    ac->bus_name = bus_name;
+    ac->account_name = account_name;
+    g_hash_table_replace (connections, connection_path, ac);
+    return ac;
+}
+
+/* Read one <len>:<bytes> field starting at *p, and advance *p past it */
+static gchar *
+read_counted_string (const gchar **p,
+                     const gchar *end)
+{
+    guint64 len;
+    gchar *colon;
+    gchar *ret;
+
+    if (*p >= end || !g_ascii_isdigit (**p))
+        return NULL;
+
+    len = g_ascii_strtoull (*p, &colon, 10);
+
+    if (colon >= end || *colon != ':' || len > (guint64) (end - colon - 1))
+        return NULL;
+
+    ret = g_strndup (colon + 1, len);
+
+    /* embedded NULs are not valid in any of the strings we store */
+    if (strlen (ret) != len)
+    {
+        g_free (ret);
+        return NULL;
+    }
+
+    *p = colon + 1 + len;
+    return ret;
+}
+
+static void
+append_counted_string (GString *str,
+                       const gchar *s)
+{
+    g_string_append_printf (str, "%" G_GSIZE_FORMAT ":%s", strlen (s), s);
+}
+
+static void
+parse_account_connections (GHashTable *connections,
+                           const gchar *p,
+                           const gchar *end,
+                           guint version)
+{
+    /* account name => connection path, both borrowed from @connections */
+    GHashTable *by_account = g_hash_table_new (g_str_hash, g_str_equal);
+
+    while (p < end)
+    {
+        gchar *connection_path = NULL, *bus_name = NULL, *account_name = NULL;
+        const gchar *old_path;
+        gchar op = '+';
+
+        if (version >= 2)
+            op = *p++;
+
+        if (op == '+')
+        {
+            connection_path = read_counted_string (&p, end);
+            bus_name = (connection_path == NULL ? NULL :
+                        read_counted_string (&p, end));
+            account_name = (bus_name == NULL ? NULL :
+                            read_counted_string (&p, end));
+        }
+        else if (op == '-')
+        {
+            account_name = read_counted_string (&p, end);
+        }
+
+        if (account_name == NULL || p >= end || *p != '\n')
+        {
+            /* probably truncated: keep what we've got so far */
+            DEBUG ("Malformed account connections file");
+            g_free (connection_path);
+            g_free (bus_name);
+            g_free (account_name);
+            break;
+        }
+
+        p++;
+
+        old_path = g_hash_table_lookup (by_account, account_name);
+
+        if (old_path != NULL)
+        {
+            g_hash_table_remove (by_account, account_name);
+            g_hash_table_remove (connections, old_path);
+        }
+
+        if (op == '+')
+        {
+            AccountConnection *ac = g_hash_table_lookup (connections,
+                                                         connection_path);
+
+            /* only one account can be using a given connection */
+            if (ac != NULL)
+                g_hash_table_remove (by_account, ac->account_name);
+
+            /* g_hash_table_replace() keeps connection_path as the key */
+            ac = account_connections_add (connections, connection_path,
+                                          bus_name, account_name);
+            g_hash_table_insert (by_account, ac->account_name,
+                                 connection_path);
+        }
+        else
+        {
+            g_free (account_name);
+        }
+    }
+
+    g_hash_table_unref (by_account);
+}
 
-    g_return_val_if_fail (path != NULL, FALSE);
-    if (!file_contents) return FALSE;
+static void
+parse_account_connections_legacy (GHashTable *connections,
+                                  const gchar *contents)
+{
+    const gchar *line, *tab1, *tab2, *endline;
 
-    len = strlen (path);
-    line = file_contents;
+    line = contents;
     while ((tab1 = strchr (line, '\t')) != NULL)
     {
-        connection_path = line;
+        const gchar *bus_name, *account_name;
 
         bus_name = tab1 + 1;
         tab2 = strchr (bus_name, '\t');
@@ -454,45 +639,96 @@ get_account_connection (const gchar *file_contents, const gchar *path,
         endline = strchr (account_name, '\n');
         if (!endline) break;
 
-        if (line + len == tab1 &&
-            strncmp (path, connection_path, len) == 0)
-        {
-            *p_bus_name = g_strndup (bus_name, tab2 - bus_name);
-            *p_account_name = g_strndup (account_name, endline - account_name);
-            return TRUE;
-        }
+        account_connections_add (connections,
+                                 g_strndup (line, tab1 - line),
+                                 g_strndup (bus_name, tab2 - bus_name),
+                                 g_strndup (account_name,
+                                            endline - account_name));
         line = endline + 1;
     }
-    return FALSE;
 }
 
-static gboolean
-recover_connection (McdAccountManager *account_manager, gchar *file_contents,
+/*
+ * load_account_connections:
+ * @filename: the account connections file
+ *
+ * Returns: (transfer full): a map from connection object path to
+ *  #AccountConnection, which is empty if @filename is missing or unreadable
+ */
+static GHashTable *
+load_account_connections (const gchar *filename)
+{
+    GHashTable *connections = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     g_free,
+                                                     account_connection_free);
+    gchar *contents;
+    gsize len;
+
+    /* if the file has no contents, we don't really care why */
+    if (!g_file_get_contents (filename, &contents, &len, NULL))
+        return connections;
+
+    if (g_str_has_prefix (contents, ACCOUNT_CONNECTIONS_HEADER))
+        parse_account_connections (connections,
+            contents + strlen (ACCOUNT_CONNECTIONS_HEADER), contents + len,
+            2);
+    else if (g_str_has_prefix (contents, ACCOUNT_CONNECTIONS_HEADER_V1))
+        parse_account_connections (connections,
+            contents + strlen (ACCOUNT_CONNECTIONS_HEADER_V1), contents + len,
+            1);
+    else if (contents[0] != '#')
+        parse_account_connections_legacy (connections, contents);
+    else
+        DEBUG ("Ignoring account connections file in unknown format");
+
+    g_free (contents);
+    return connections;
+}
+
+/*
+ * Returns: (transfer none): the McdConnection for @name, or %NULL if we
+ *  don't know which account it belongs to
+ */
+static McdConnection *
+recover_connection (McdAccountManager *account_manager,
+                    GHashTable *connections,
                     const gchar *name)
 {
     McdAccount *account;
-    McdConnection *connection;
+    McdConnection *connection = NULL;
     McdManager *manager;
     McdMaster *master;
     const gchar *manager_name;
-    gchar *object_path, *bus_name, *account_name;
+    AccountConnection *ac;
+    gchar *object_path;
     GError *error = NULL;
-    gboolean ret = FALSE;
+    McdConnection *ret = NULL;
 
     master = mcd_master_get_default ();
-    g_return_val_if_fail (MCD_IS_MASTER (master), FALSE);
+    g_return_val_if_fail (MCD_IS_MASTER (master), NULL);
 
     object_path = g_strdelimit (g_strdup_printf ("/%s", name), ".", '/');
-    if (!get_account_connection (file_contents, object_path,
-                                 &bus_name, &account_name))
+    ac = g_hash_table_lookup (connections, object_path);
+    if (ac == NULL)
         goto err_match;
 
     account = g_hash_table_lookup (account_manager->priv->accounts,
-                                   account_name);
+                                   ac->account_name);
     if (!account || !mcd_account_is_enabled (account))
         goto err_account;
 
     DEBUG ("account is %s", mcd_account_get_unique_name (account));
+
+    /* if the account has already started connecting by itself, we'd only
+     * be replacing that attempt */
+    if (mcd_account_get_connection (account) != NULL ||
+        mcd_account_get_connection_status (account) !=
+            TP_CONNECTION_STATUS_DISCONNECTED)
+    {
+        DEBUG ("%s already has a connection", ac->account_name);
+        goto err_account;
+    }
+
     manager_name = mcd_account_get_manager_name (account);
 
     manager = _mcd_master_lookup_manager (master, manager_name);
@@ -505,26 +741,175 @@ recover_connection (McdAccountManager *account_manager, gchar *file_contents,
     connection = mcd_manager_create_connection (manager, account);
     if (G_UNLIKELY (!connection)) goto err_connection;
 
-    _mcd_connection_set_tp_connection (connection, bus_name, object_path,
-                                       &error);
+    _mcd_connection_attach_tp_connection (connection, ac->bus_name,
+                                          object_path, &error);
     if (G_UNLIKELY (error))
     {
         DEBUG ("got error: %s", error->message);
         g_error_free (error);
         goto err_connection;
     }
-    ret = TRUE;
+    ret = connection;
 
 err_connection:
 err_manager:
 err_account:
-    g_free (account_name);
-    g_free (bus_name);
 err_match:
     g_free (object_path);
     return ret;
 }
 
+static void
+kill_connection (McdAccountManager *self,
+                 const gchar *name)
+{
+    TpConnection *proxy;
+    gchar *path;
+
+    path = g_strdup_printf ("/%s", name);
+    g_strdelimit (path, ".", '/');
+
+    DEBUG ("Killing connection");
+    proxy = tp_simple_client_factory_ensure_connection (
+        self->priv->client_factory, path, NULL, NULL);
+
+    if (proxy)
+    {
+        tp_cli_connection_call_disconnect (proxy, -1, NULL, NULL,
+                                           NULL, NULL);
+        g_object_unref (proxy);
+    }
+
+    g_free (path);
+}
+
+/*
+ * Connections that were already running when we started are all attached
+ * to their accounts straight away, but are introspected a few at a time,
+ * so that a host with many of them doesn't flood the bus and the
+ * connection managers with introspection calls. A connection
+ * stops counting against the limit when it becomes ready, disconnects, or
+ * has taken longer than RECOVERY_SLOT_TIMEOUT seconds; in the last case
+ * it carries on being recovered in the background.
+ */
+#define MAX_CONCURRENT_RECOVERIES 8
+#define RECOVERY_SLOT_TIMEOUT 5
+
+typedef struct {
+    McdAccountManager *self;
+    /* ref'd */
+    McdConnection *connection;
+    guint timeout_id;
+} RecoveringConnection;
+
+static void recovery_continue (McdAccountManager *self);
+
+static void
+recovering_connection_free (RecoveringConnection *rc)
+{
+    g_signal_handlers_disconnect_by_data (rc->connection, rc);
+
+    if (rc->timeout_id != 0)
+        g_source_remove (rc->timeout_id);
+
+    g_object_unref (rc->connection);
+    g_slice_free (RecoveringConnection, rc);
+}
+
+static void
+recovering_connection_done (RecoveringConnection *rc,
+                            const gchar *how)
+{
+    McdAccountManager *self = rc->self;
+    McdAccountManagerPrivate *priv = self->priv;
+
+    DEBUG ("%s %s", mcd_connection_get_object_path (rc->connection), how);
+
+    priv->recovering = g_list_remove (priv->recovering, rc);
+    recovering_connection_free (rc);
+    priv->recovery_finished++;
+    recovery_continue (self);
+}
+
+static void
+recovering_connection_ready_cb (McdConnection *connection,
+                                RecoveringConnection *rc)
+{
+    recovering_connection_done (rc, "is ready");
+}
+
+static void
+recovering_connection_status_cb (McdConnection *connection,
+                                 TpConnectionStatus status,
+                                 TpConnectionStatusReason reason,
+                                 TpConnection *tp_conn,
+                                 const gchar *dbus_error,
+                                 GHashTable *details,
+                                 RecoveringConnection *rc)
+{
+    if (status == TP_CONNECTION_STATUS_DISCONNECTED)
+        recovering_connection_done (rc, "disconnected");
+}
+
+static gboolean
+recovering_connection_timeout_cb (gpointer data)
+{
+    RecoveringConnection *rc = data;
+
+    rc->timeout_id = 0;
+    recovering_connection_done (rc, "is taking a while, moving on");
+    return FALSE;
+}
+
+static void
+recovery_continue (McdAccountManager *self)
+{
+    McdAccountManagerPrivate *priv = self->priv;
+
+    while (!g_queue_is_empty (&priv->recovery_queue) &&
+           g_list_length (priv->recovering) < MAX_CONCURRENT_RECOVERIES)
+    {
+        McdConnection *connection = g_queue_pop_head (&priv->recovery_queue);
+        RecoveringConnection *rc;
+
+        /* it might have been closed while it was waiting */
+        if (mcd_connection_get_tp_connection (connection) == NULL)
+        {
+            DEBUG ("%p went away before we got to it", connection);
+            g_object_unref (connection);
+            priv->recovery_finished++;
+            continue;
+        }
+
+        DEBUG ("Connection %s", mcd_connection_get_object_path (connection));
+
+        rc = g_slice_new0 (RecoveringConnection);
+        rc->self = self;
+        /* takes the queue's ref */
+        rc->connection = connection;
+        g_signal_connect (connection, "ready",
+                          G_CALLBACK (recovering_connection_ready_cb), rc);
+        g_signal_connect (connection, "connection-status-changed",
+                          G_CALLBACK (recovering_connection_status_cb), rc);
+        rc->timeout_id = g_timeout_add_seconds (RECOVERY_SLOT_TIMEOUT,
+            recovering_connection_timeout_cb, rc);
+        priv->recovering = g_list_prepend (priv->recovering, rc);
+
+        _mcd_connection_prepare_tp_connection (connection);
+    }
+
+    DEBUG ("%u of %u connections recovered", priv->recovery_finished,
+           priv->recovery_total);
+
+    if (priv->recovering == NULL && priv->recovery_started != 0)
+    {
+        DEBUG ("recovering %u connections took %" G_GINT64_FORMAT "ms",
+               priv->recovery_total,
+               (g_get_monotonic_time () - priv->recovery_started) / 1000);
+        priv->recovery_started = 0;
+    }
+}
+
 static void
 list_connection_names_cb (const gchar * const *names, gsize n,
                           const gchar * const *cms,
@@ -534,46 +919,43 @@ list_connection_names_cb (const gchar * const *names, gsize n,
 {
     McdAccountManager *account_manager = MCD_ACCOUNT_MANAGER (weak_object);
     McdAccountManagerPrivate *priv = account_manager->priv;
-    gchar *contents = NULL;
+    GHashTable *connections;
     guint i;
 
     DEBUG ("%" G_GSIZE_FORMAT " connections", n);
 
-    /* if the file has no contents, we don't really care why */
-    if (!g_file_get_contents (priv->account_connections_file, &contents,
-                              NULL, NULL))
-    {
-        contents = NULL;
-    }
+    g_return_if_fail (priv->recovery_started == 0);
+
+    connections = load_account_connections (priv->account_connections_file);
+    priv->recovery_started = g_get_monotonic_time ();
 
+    /* Attach every connection to its account now, so that the accounts
+     * don't try to make new connections while they're waiting */
     for (i = 0; i < n; i++)
     {
-        g_return_if_fail (names[i] != NULL);
-        DEBUG ("Connection %s", names[i]);
-        if (!recover_connection (account_manager, contents, names[i]))
-        {
-            /* Close the connection */
-            TpConnection *proxy;
-            gchar *path;
-
-            path = g_strdup_printf ("/%s", names[i]);
-            g_strdelimit (path, ".", '/');
+        McdConnection *connection;
 
-            DEBUG ("Killing connection");
-            proxy = tp_simple_client_factory_ensure_connection (
-                priv->client_factory, path, NULL, NULL);
+        if (names[i] == NULL)
+            break;
 
-            if (proxy)
-            {
-                tp_cli_connection_call_disconnect (proxy, -1, NULL, NULL,
-                                                   NULL, NULL);
-                g_object_unref (proxy);
-            }
+        DEBUG ("Connection %s", names[i]);
+        connection = recover_connection (account_manager, connections,
+                                         names[i]);
 
-            g_free (path);
+        if (connection == NULL)
+        {
+            kill_connection (account_manager, names[i]);
+        }
+        else
+        {
+            g_queue_push_tail (&priv->recovery_queue,
+                               g_object_ref (connection));
+            priv->recovery_total++;
         }
     }
-    g_free (contents);
+
+    g_hash_table_unref (connections);
+    recovery_continue (account_manager);
 }
 
 static void
@@ -625,8 +1007,8 @@ unref_account (gpointer data)
     g_object_unref (account);
 }
 
-static void _mcd_account_manager_store_account_connections (
-    McdAccountManager *);
+static void account_connection_path_changed_cb (McdAccount *account,
+    const gchar *path, McdAccountManager *self);
 
 static void
 add_account (McdAccountManager *account_manager, McdAccount *account,
@@ -656,8 +1038,7 @@ add_account (McdAccountManager *account_manager, McdAccount *account,
     g_signal_connect (account, "removed", G_CALLBACK (on_account_removed),
 		      account_manager);
     tp_g_signal_connect_object (account, "connection-path-changed",
-        G_CALLBACK (_mcd_account_manager_store_account_connections),
-        account_manager, G_CONNECT_SWAPPED);
+        G_CALLBACK (account_connection_path_changed_cb), account_manager, 0);
 
     /* some reports indicate this doesn't always fire for async backend  *
      * accounts: testing here hasn't shown this, but at least we will be *
@@ -1562,6 +1943,9 @@ _mcd_account_manager_finalize (GObject *object)
 
     tp_clear_object (&priv->storage);
     g_free (priv->account_connections_dir);
+    if (priv->account_connections_log != NULL)
+        fclose (priv->account_connections_log);
+    tp_clear_pointer (&priv->stored_connections, g_hash_table_unref);
     remove (priv->account_connections_file);
     g_free (priv->account_connections_file);
 
@@ -1575,6 +1959,12 @@ _mcd_account_manager_dispose (GObject *object)
 {
     McdAccountManagerPrivate *priv = MCD_ACCOUNT_MANAGER_PRIV (object);
 
+    g_queue_foreach (&priv->recovery_queue, (GFunc) g_object_unref, NULL);
+    g_queue_clear (&priv->recovery_queue);
+    g_list_free_full (priv->recovering,
+                      (GDestroyNotify) recovering_connection_free);
+    priv->recovering = NULL;
+
     tp_clear_object (&priv->dbus_daemon);
     tp_clear_object (&priv->client_factory);
     tp_clear_object (&priv->minotaur);
@@ -1636,6 +2026,7 @@ mcd_account_manager_init (McdAccountManager *account_manager)
 					MCD_TYPE_ACCOUNT_MANAGER,
 					McdAccountManagerPrivate);
     account_manager->priv = priv;
+    g_queue_init (&priv->recovery_queue);
 }
 
 static void
@@ -1656,6 +2047,8 @@ _mcd_account_manager_constructed (GObject *obj)
     priv->account_connections_file =
         g_build_filename (priv->account_connections_dir, ".mc_connections",
                           NULL);
+    priv->stored_connections = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free, g_free);
 
     DEBUG ("loading plugins");
     mcd_storage_load (priv->storage);
@@ -1728,49 +2121,153 @@ mcd_account_manager_lookup_account_by_path (McdAccountManager *account_manager,
 }
 
 /*
- * _mcd_account_manager_store_account_connections:
- * @account_manager: the #McdAccountManager.
+ * rewrite_account_connections:
+ * @self: the #McdAccountManager.
  *
- * This function is used to remember what connection an account was bound to.
- * The data is stored in a temporary file, and can be read when MC restarts
- * after a crash.
+ * Atomically replace the account connections file with one that records
+ * the current connection of each account, and nothing else.
  */
 static void
-_mcd_account_manager_store_account_connections (McdAccountManager *manager)
+rewrite_account_connections (McdAccountManager *self)
 {
-    McdAccountManagerPrivate *priv;
+    McdAccountManagerPrivate *priv = self->priv;
     GHashTableIter iter;
-    const gchar *account_name, *connection_path, *connection_name;
-    McdAccount *account;
-    FILE *file;
+    gpointer k, v;
+    GString *contents;
+    GError *error = NULL;
+
+    if (priv->account_connections_log != NULL)
+    {
+        fclose (priv->account_connections_log);
+        priv->account_connections_log = NULL;
+    }
+
+    g_hash_table_remove_all (priv->stored_connections);
+    contents = g_string_new (ACCOUNT_CONNECTIONS_HEADER);
+
+    g_hash_table_iter_init (&iter, priv->accounts);
+    while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+        McdConnection *connection = mcd_account_get_connection (v);
+        const gchar *connection_path, *connection_name;
+
+        if (connection == NULL)
+            continue;
 
-    g_return_if_fail (MCD_IS_ACCOUNT_MANAGER (manager));
-    priv = manager->priv;
+        connection_path = mcd_connection_get_object_path (connection);
+        connection_name = mcd_connection_get_name (connection);
+
+        if (connection_path == NULL || connection_name == NULL)
+            continue;
+
+        g_string_append_c (contents, '+');
+        append_counted_string (contents, connection_path);
+        append_counted_string (contents, connection_name);
+        append_counted_string (contents, k);
+        g_string_append_c (contents, '\n');
+        g_hash_table_insert (priv->stored_connections, g_strdup (k),
+                             g_strdup (connection_path));
+    }
+
+    priv->account_connections_records =
+        g_hash_table_size (priv->stored_connections);
 
     /* make $XDG_CACHE_DIR (or whatever) if it doesn't exist */
     g_mkdir_with_parents (priv->account_connections_dir, 0700);
     _mcd_chmod_private (priv->account_connections_dir);
 
-    file = fopen (priv->account_connections_file, "w");
-    if (G_UNLIKELY (!file)) return;
+    if (!g_file_set_contents (priv->account_connections_file, contents->str,
+                              contents->len, &error))
+    {
+        /* leave account_connections_log NULL, so we try again next time */
+        DEBUG ("Unable to save account connections: %s", error->message);
+        g_error_free (error);
+    }
+    else
+    {
+        priv->account_connections_log =
+            fopen (priv->account_connections_file, "a");
+    }
+
+    g_string_free (contents, TRUE);
+}
 
-    g_hash_table_iter_init (&iter, priv->accounts);
-    while (g_hash_table_iter_next (&iter, (gpointer)&account_name,
-                                   (gpointer)&account))
+/*
+ * account_connection_path_changed_cb:
+ *
+ * Remember what connection an account is bound to, so that it can be
+ * recovered if MC restarts after a crash. Only the change for this account
+ * is appended to the file, unless it is due to be compacted.
+ */
+static void
+account_connection_path_changed_cb (McdAccount *account,
+                                    const gchar *path,
+                                    McdAccountManager *self)
+{
+    McdAccountManagerPrivate *priv = self->priv;
+    const gchar *account_name = mcd_account_get_unique_name (account);
+    McdConnection *connection = mcd_account_get_connection (account);
+    const gchar *connection_path = NULL;
+    const gchar *connection_name = NULL;
+    GString *record;
+
+    if (connection != NULL)
     {
-        McdConnection *connection;
+        connection_path = mcd_connection_get_object_path (connection);
+        connection_name = mcd_connection_get_name (connection);
+    }
 
-        connection = mcd_account_get_connection (account);
-        if (connection)
-        {
-            connection_path = mcd_connection_get_object_path (connection);
-            connection_name = mcd_connection_get_name (connection);
-            if (connection_path && connection_name)
-                fprintf (file, "%s\t%s\t%s\n",
-                         connection_path, connection_name, account_name);
-        }
+    if (connection_name == NULL)
+        connection_path = NULL;
+
+    if (!tp_strdiff (connection_path,
+            g_hash_table_lookup (priv->stored_connections, account_name)))
+        return;
+
+    if (priv->account_connections_log == NULL ||
+        (priv->account_connections_records >=
+            ACCOUNT_CONNECTIONS_COMPACT_MIN &&
+         priv->account_connections_records >=
+            ACCOUNT_CONNECTIONS_COMPACT_RATIO *
+            g_hash_table_size (priv->stored_connections)))
+    {
+        rewrite_account_connections (self);
+        return;
+    }
+
+    record = g_string_new ("");
+
+    if (connection_path == NULL)
+    {
+        g_string_append_c (record, '-');
+        append_counted_string (record, account_name);
+        g_hash_table_remove (priv->stored_connections, account_name);
+    }
+    else
+    {
+        g_string_append_c (record, '+');
+        append_counted_string (record, connection_path);
+        append_counted_string (record, connection_name);
+        append_counted_string (record, account_name);
+        g_hash_table_replace (priv->stored_connections,
+                              g_strdup (account_name),
+                              g_strdup (connection_path));
     }
-    fclose (file);
+
+    g_string_append_c (record, '\n');
+
+    if (fwrite (record->str, 1, record->len, priv->account_connections_log) !=
+            record->len ||
+        fflush (priv->account_connections_log) != 0)
+    {
+        DEBUG ("Unable to append to %s, will rewrite it",
+               priv->account_connections_file);
+        fclose (priv->account_connections_log);
+        priv->account_connections_log = NULL;
+    }
+
+    priv->account_connections_records++;
+    g_string_free (record, TRUE);
 }
 
 McdStorage *
@@ -113,6 +113,8 @@ _mcd_account_write_conf (McdAccount *account)
 
 G_GNUC_INTERNAL void _mcd_account_connection_begin (McdAccount *account,
                                                     gboolean user_initiated);
+G_GNUC_INTERNAL gboolean _mcd_account_connection_scheduled (
+    McdAccount *account);
 
 extern const McdDBusProp account_channelrequests_properties[];
 
@@ -39,6 +39,7 @@
 #include "mcd-account-manager.h"
 #include "mcd-dispatcher-priv.h"
 #include "mcd-channel-priv.h"
+#include "mcd-connect-scheduler.h"
 #include "mcd-misc.h"
 #include "request.h"
 
@@ -141,6 +142,8 @@ _mcd_account_create_request (McdClientRegistry *clients,
         return NULL;
     }
 
+    _mcd_connect_scheduler_note_user_activity (account);
+
     /* We MUST deep-copy the hash-table, as we don't know how dbus-glib will
      * free it */
     props = _mcd_deepcopy_asv (properties);
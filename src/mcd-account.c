@@ -36,6 +36,7 @@
 #include "mcd-account-priv.h"
 #include "mcd-account-manager-priv.h"
 #include "mcd-account-addressing.h"
+#include "mcd-connect-scheduler.h"
 #include "mcd-connection-priv.h"
 #include "mcd-misc.h"
 #include "mcd-manager.h"
@@ -43,6 +44,7 @@
 #include "mcd-master.h"
 #include "mcd-master-priv.h"
 #include "mcd-dbusprop.h"
+#include "mcd-timer-wheel.h"
 
 #define MC_OLD_AVATAR_FILENAME	"avatar.bin"
 
@@ -91,6 +93,8 @@ typedef struct {
 typedef struct {
     GHashTable *params;
     gboolean user_initiated;
+    /* TRUE if the connect scheduler has said it's our turn */
+    gboolean scheduled;
 } McdAccountConnectionContext;
 
 struct _McdAccountPrivate
@@ -725,6 +729,9 @@ mcd_account_request_presence_int (McdAccount *account,
     McdAccountPrivate *priv = account->priv;
     gboolean changed = FALSE;
 
+    if (user_initiated)
+        _mcd_connect_scheduler_note_user_activity (account);
+
     if (priv->req_presence_type != type)
     {
         priv->req_presence_type = type;
@@ -866,7 +873,7 @@ emit_property_changed (gpointer userdata)
 
     if (priv->properties_source != 0)
     {
-      g_source_remove (priv->properties_source);
+      _mcd_timer_wheel_remove (priv->properties_source);
       priv->properties_source = 0;
     }
     return FALSE;
@@ -919,10 +926,8 @@ mcd_account_changed_property (McdAccount *account, const gchar *key,
     if (priv->properties_source == 0)
     {
         DEBUG ("First changed property");
-        priv->properties_source = g_timeout_add_full (G_PRIORITY_DEFAULT, 10,
-                                                      emit_property_changed,
-                                                      g_object_ref (account),
-                                                      g_object_unref);
+        priv->properties_source = _mcd_timer_wheel_add_full (10, 10,
+            emit_property_changed, g_object_ref (account), g_object_unref);
     }
     g_hash_table_insert (priv->changed_properties, (gpointer) key,
                          tp_g_value_slice_dup (value));
@@ -3254,7 +3259,7 @@ _mcd_account_finalize (GObject *object)
     if (priv->changed_properties)
 	g_hash_table_unref (priv->changed_properties);
     if (priv->properties_source != 0)
-	g_source_remove (priv->properties_source);
+	_mcd_timer_wheel_remove (priv->properties_source);
 
     tp_clear_pointer (&priv->curr_presence_status, g_free);
     tp_clear_pointer (&priv->curr_presence_message, g_free);
@@ -3290,6 +3295,8 @@ _mcd_account_dispose (GObject *object)
         tp_svc_account_emit_removed (self);
     }
 
+    _mcd_connect_scheduler_cancel (self);
+
     if (priv->online_requests)
     {
         GError *error;
@@ -4274,9 +4281,12 @@ _mcd_account_set_connection_status (McdAccount *account,
         priv->conn_dbus_error = g_strdup ("");
         g_hash_table_remove_all (priv->conn_error_details);
 
+        _mcd_connect_scheduler_attempt_finished (account);
     }
     else if (status == TP_CONNECTION_STATUS_DISCONNECTED)
     {
+        _mcd_connect_scheduler_attempt_finished (account);
+
         /* we'll get this from the TpContact soon, but it makes sense
          * to bundle everything together into one signal */
         mcd_account_update_self_presence (account,
@@ -5038,6 +5048,11 @@ _mcd_account_connection_begin (McdAccount *account,
     if (account->priv->connection_context != NULL)
     {
         DEBUG ("already trying to connect");
+
+        /* if we're still waiting for our turn, the user doesn't want to */
+        if (user_initiated)
+            _mcd_connect_scheduler_hurry (account);
+
         return;
     }
 
@@ -5046,6 +5061,7 @@ _mcd_account_connection_begin (McdAccount *account,
     /* run the handlers */
     ctx = g_malloc (sizeof (McdAccountConnectionContext));
     ctx->user_initiated = user_initiated;
+    ctx->scheduled = FALSE;
 
     /* If we get this far, the account should be valid, so getting the
      * protocol should succeed.
@@ -5123,7 +5139,13 @@ mcd_account_connection_proceed_with_reason (McdAccount *account,
     if (!delayed)
     {
 	/* end of the chain */
-	if (success)
+	if (success && !ctx->user_initiated && !ctx->scheduled)
+	{
+            /* don't connect everything at once: wait for our turn */
+            _mcd_connect_scheduler_enqueue (account);
+            return;
+	}
+	else if (success)
 	{
 	    _mcd_account_connect (account, ctx->params);
 	}
@@ -5137,3 +5159,48 @@ mcd_account_connection_proceed_with_reason (McdAccount *account,
             _mcd_account_connection_context_free);
     }
 }
+
+/*
+ * _mcd_account_connection_scheduled:
+ * @account: an account
+ *
+ * Called by the connect scheduler when it's @account's turn to connect.
+ *
+ * Returns: %TRUE if @account has started connecting, %FALSE if it no longer
+ *  wants to, or has to wait for connectivity again
+ */
+gboolean
+_mcd_account_connection_scheduled (McdAccount *account)
+{
+    McdAccountPrivate *priv = account->priv;
+    McdAccountConnectionContext *ctx = priv->connection_context;
+
+    if (ctx == NULL)
+        return FALSE;
+
+    /* the account might have been disabled, or the user might have asked
+     * for it to go offline, while it was waiting for its turn */
+    if (!priv->enabled || !mcd_account_is_valid (account) ||
+        !_presence_type_is_online (priv->req_presence_type))
+    {
+        DEBUG ("%s no longer wants to connect", priv->unique_name);
+        tp_clear_pointer (&priv->connection_context,
+            _mcd_account_connection_context_free);
+        _mcd_account_set_connection_status (account,
+            TP_CONNECTION_STATUS_DISCONNECTED,
+            TP_CONNECTION_STATUS_REASON_REQUESTED, NULL,
+            TP_ERROR_STR_CANCELLED, NULL);
+        return FALSE;
+    }
+
+    ctx->scheduled = TRUE;
+    mcd_account_connection_proceed_with_reason
+        (account, TRUE, TP_CONNECTION_STATUS_REASON_NONE_SPECIFIED);
+
+    if (account->priv->connection_context == NULL)
+        return TRUE;
+
+    /* we went offline again; we'll have to queue up next time */
+    ctx->scheduled = FALSE;
+    return FALSE;
+}
@@ -955,8 +955,9 @@ _mcd_channel_get_satisfied_requests (McdChannel *channel,
  * _mcd_channel_get_request_preferred_handler:
  * @channel: the #McdChannel.
  *
- * Returns: the preferred handler specified when requesting the channel, if the
- * channel is in MCD_CHANNEL_REQUEST status.
+ * Returns: the preferred handler specified when requesting the channel (or,
+ * for an urgent request without one, the handler chosen when it was made), if
+ * the channel is in MCD_CHANNEL_REQUEST status.
  */
 const gchar *
 _mcd_channel_get_request_preferred_handler (McdChannel *channel)
@@ -966,7 +967,7 @@ _mcd_channel_get_request_preferred_handler (McdChannel *channel)
     if (G_UNLIKELY (channel->priv->request == NULL))
         return NULL;
 
-    return _mcd_request_get_preferred_handler (channel->priv->request);
+    return _mcd_request_get_handler_hint (channel->priv->request);
 }
 
 /*
@@ -0,0 +1,382 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Index of installed .client files.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include "mcd-client-files.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "mcd-debug.h"
+
+#define CLIENT_FILE_SUFFIX ".client"
+
+/*
+ * The full path of a client file is
+ * $XDG_DATA_HOME/telepathy/clients/clientname.client or
+ * $XDG_DATA_DIRS/telepathy/clients/clientname.client; for testing purposes,
+ * $MC_CLIENTS_DIR/clientname.client takes precedence over both if
+ * $MC_CLIENTS_DIR is set.
+ *
+ * Rather than looking in each of those directories every time a client
+ * appears, we list them all once, and watch them for changes. Clients
+ * that are not in the index are still looked up directly.
+ */
+
+typedef struct {
+    /* owned */
+    gchar *path;
+    /* modification time of @path when we last looked */
+    guint64 mtime;
+    /* @path, parsed, or NULL if not loaded since it last changed */
+    GKeyFile *key_file;
+} ClientFile;
+
+/* owned gchar * directory, most important first */
+static GPtrArray *directories = NULL;
+/* owned GFileMonitor for each of @directories that could be watched */
+static GPtrArray *monitors = NULL;
+/* owned gchar * client name (without .client) -> owned ClientFile */
+static GHashTable *client_files = NULL;
+
+static void
+client_file_free (gpointer p)
+{
+    ClientFile *cf = p;
+
+    g_free (cf->path);
+
+    if (cf->key_file != NULL)
+        g_key_file_unref (cf->key_file);
+
+    g_slice_free (ClientFile, cf);
+}
+
+static guint64
+get_mtime (GFile *file)
+{
+    GFileInfo *info;
+    guint64 mtime = 0;
+
+    info = g_file_query_info (file,
+        G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
+        G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+    if (info == NULL)
+        return 0;
+
+    if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR)
+        mtime = MAX (1, g_file_info_get_attribute_uint64 (info,
+                G_FILE_ATTRIBUTE_TIME_MODIFIED));
+
+    g_object_unref (info);
+    return mtime;
+}
+
+/*
+ * Look for @client_name's file in each directory, in order of precedence,
+ * and update the index accordingly. This is only needed when something
+ * changes after we have listed the directories.
+ */
+static void
+reindex_client (const gchar *client_name)
+{
+    ClientFile *old = g_hash_table_lookup (client_files, client_name);
+    gchar *basename = g_strconcat (client_name, CLIENT_FILE_SUFFIX, NULL);
+    guint i;
+
+    /* mtime only has a resolution of a second, so don't trust a cached
+     * parse of a file we've just been told about */
+    if (old != NULL && old->key_file != NULL)
+    {
+        g_key_file_unref (old->key_file);
+        old->key_file = NULL;
+    }
+
+    for (i = 0; i < directories->len; i++)
+    {
+        gchar *path = g_build_filename (g_ptr_array_index (directories, i),
+                                        basename, NULL);
+        GFile *file = g_file_new_for_path (path);
+        guint64 mtime = get_mtime (file);
+
+        g_object_unref (file);
+
+        if (mtime != 0)
+        {
+            ClientFile *cf = old;
+
+            if (cf == NULL || cf->mtime != mtime ||
+                tp_strdiff (cf->path, path))
+            {
+                DEBUG ("%s is now %s", client_name, path);
+
+                cf = g_slice_new0 (ClientFile);
+                cf->path = path;
+                cf->mtime = mtime;
+                g_hash_table_replace (client_files, g_strdup (client_name), cf);
+            }
+            else
+            {
+                g_free (path);
+            }
+
+            g_free (basename);
+            return;
+        }
+
+        g_free (path);
+    }
+
+    if (g_hash_table_remove (client_files, client_name))
+        DEBUG ("%s no longer has a .client file", client_name);
+
+    g_free (basename);
+}
+
+static gchar *
+client_name_from_file (GFile *file)
+{
+    gchar *basename = g_file_get_basename (file);
+    gchar *ret = NULL;
+
+    if (basename != NULL && g_str_has_suffix (basename, CLIENT_FILE_SUFFIX))
+        ret = g_strndup (basename,
+                         strlen (basename) - strlen (CLIENT_FILE_SUFFIX));
+
+    g_free (basename);
+    return ret;
+}
+
+static void
+directory_changed_cb (GFileMonitor *monitor,
+                      GFile *file,
+                      GFile *other_file,
+                      GFileMonitorEvent event_type,
+                      gpointer user_data G_GNUC_UNUSED)
+{
+    gchar *client_name;
+
+    switch (event_type)
+    {
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_MOVED:
+            break;
+
+        default:
+            return;
+    }
+
+    client_name = client_name_from_file (file);
+
+    if (client_name != NULL)
+    {
+        reindex_client (client_name);
+        g_free (client_name);
+    }
+
+    if (other_file != NULL)
+    {
+        client_name = client_name_from_file (other_file);
+
+        if (client_name != NULL)
+        {
+            reindex_client (client_name);
+            g_free (client_name);
+        }
+    }
+}
+
+/* Add the .client files in @dirname that are not overridden by a more
+ * important directory */
+static void
+index_directory (const gchar *dirname)
+{
+    GFile *dir = g_file_new_for_path (dirname);
+    GFileEnumerator *children;
+    GFileMonitor *monitor;
+    GFileInfo *info;
+
+    monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_SEND_MOVED, NULL,
+                                        NULL);
+
+    if (monitor != NULL)
+    {
+        g_signal_connect (monitor, "changed",
+                          G_CALLBACK (directory_changed_cb), NULL);
+        g_ptr_array_add (monitors, monitor);
+    }
+
+    children = g_file_enumerate_children (dir,
+        G_FILE_ATTRIBUTE_STANDARD_NAME ","
+        G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+        G_FILE_ATTRIBUTE_TIME_MODIFIED,
+        G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+    if (children == NULL)
+    {
+        /* most of the XDG_DATA_DIRS won't have any clients */
+        g_object_unref (dir);
+        return;
+    }
+
+    while ((info = g_file_enumerator_next_file (children, NULL, NULL)) != NULL)
+    {
+        const gchar *name = g_file_info_get_name (info);
+
+        if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR &&
+            g_str_has_suffix (name, CLIENT_FILE_SUFFIX))
+        {
+            gchar *client_name = g_strndup (name,
+                strlen (name) - strlen (CLIENT_FILE_SUFFIX));
+
+            if (g_hash_table_contains (client_files, client_name))
+            {
+                g_free (client_name);
+            }
+            else
+            {
+                ClientFile *cf = g_slice_new0 (ClientFile);
+
+                cf->path = g_build_filename (dirname, name, NULL);
+                cf->mtime = MAX (1, g_file_info_get_attribute_uint64 (info,
+                        G_FILE_ATTRIBUTE_TIME_MODIFIED));
+                g_hash_table_insert (client_files, client_name, cf);
+            }
+        }
+
+        g_object_unref (info);
+    }
+
+    g_object_unref (children);
+    g_object_unref (dir);
+}
+
+static void
+ensure_index (void)
+{
+    const gchar * const *dirs;
+    const gchar *dirname;
+    guint i;
+
+    if (G_LIKELY (client_files != NULL))
+        return;
+
+    directories = g_ptr_array_new_with_free_func (g_free);
+    monitors = g_ptr_array_new_with_free_func (g_object_unref);
+    client_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                   client_file_free);
+
+    dirname = g_getenv ("MC_CLIENTS_DIR");
+
+    if (dirname != NULL)
+        g_ptr_array_add (directories, g_strdup (dirname));
+
+    dirname = g_get_user_data_dir ();
+
+    if (G_LIKELY (dirname != NULL))
+        g_ptr_array_add (directories,
+            g_build_filename (dirname, "telepathy", "clients", NULL));
+
+    for (dirs = g_get_system_data_dirs (); *dirs != NULL; dirs++)
+        g_ptr_array_add (directories,
+            g_build_filename (*dirs, "telepathy", "clients", NULL));
+
+    for (i = 0; i < directories->len; i++)
+        index_directory (g_ptr_array_index (directories, i));
+
+    DEBUG ("found %u .client files in %u directories",
+           g_hash_table_size (client_files), directories->len);
+}
+
+/*
+ * _mcd_client_files_load:
+ * @client_name: the name of a client, without the
+ *  org.freedesktop.Telepathy.Client. prefix
+ * @error: used to raise an error if the file could not be parsed
+ *
+ * Returns: (transfer full): the contents of @client_name's .client file,
+ *  or %NULL with @error unset if it has none, or %NULL with @error set if
+ *  it could not be parsed. The file is only read again if its
+ *  modification time has changed since it was last loaded.
+ */
+GKeyFile *
+_mcd_client_files_load (const gchar *client_name,
+                        GError **error)
+{
+    ClientFile *cf;
+
+    ensure_index ();
+
+    cf = g_hash_table_lookup (client_files, client_name);
+
+    if (cf != NULL)
+    {
+        /* For the same reasons as below, a hit might be stale: check that
+         * the file is still there and hasn't changed since we indexed it. */
+        GFile *file = g_file_new_for_path (cf->path);
+        guint64 mtime = get_mtime (file);
+
+        g_object_unref (file);
+
+        if (mtime == 0 || mtime != cf->mtime)
+        {
+            DEBUG ("%s has changed behind our back", cf->path);
+            cf = NULL;
+        }
+    }
+
+    if (cf == NULL)
+    {
+        /* A directory might not be watchable, or the file might have been
+         * installed so recently that its change notification hasn't been
+         * dispatched yet, so a miss is not final: look again, as we would
+         * have done without the index. */
+        reindex_client (client_name);
+        cf = g_hash_table_lookup (client_files, client_name);
+
+        if (cf == NULL)
+            return NULL;
+    }
+
+    if (cf->key_file == NULL)
+    {
+        GKeyFile *key_file = g_key_file_new ();
+
+        if (!g_key_file_load_from_file (key_file, cf->path, 0, error))
+        {
+            g_key_file_unref (key_file);
+            return NULL;
+        }
+
+        cf->key_file = key_file;
+    }
+
+    return g_key_file_ref (cf->key_file);
+}
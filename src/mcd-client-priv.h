@@ -49,6 +49,15 @@ struct _McdClientProxyClass
   TpClientClass parent_class;
 };
 
+/* The Client interfaces that matter for dispatching, as a bitfield */
+typedef enum
+{
+  MCD_CLIENT_ROLE_NONE = 0,
+  MCD_CLIENT_ROLE_APPROVER = (1 << 0),
+  MCD_CLIENT_ROLE_HANDLER = (1 << 1),
+  MCD_CLIENT_ROLE_OBSERVER = (1 << 2)
+} McdClientRoles;
+
 G_GNUC_INTERNAL GType _mcd_client_proxy_get_type (void);
 
 #define MCD_TYPE_CLIENT_PROXY \
@@ -74,6 +83,10 @@ G_GNUC_INTERNAL McdClientProxy *_mcd_client_proxy_new (
     gboolean activatable);
 
 G_GNUC_INTERNAL gboolean _mcd_client_proxy_is_ready (McdClientProxy *self);
+G_GNUC_INTERNAL void _mcd_client_proxy_introspect_on_bus (
+    McdClientProxy *self);
+G_GNUC_INTERNAL gboolean _mcd_client_proxy_has_client_file (
+    McdClientProxy *self);
 
 G_GNUC_INTERNAL gboolean _mcd_client_check_valid_name (
     const gchar *name_suffix, GError **error);
@@ -84,6 +97,9 @@ G_GNUC_INTERNAL gboolean _mcd_client_proxy_is_activatable
 G_GNUC_INTERNAL const gchar *_mcd_client_proxy_get_unique_name (
     McdClientProxy *self);
 
+G_GNUC_INTERNAL McdClientRoles _mcd_client_proxy_get_roles (
+    McdClientProxy *self);
+
 G_GNUC_INTERNAL void _mcd_client_proxy_set_inactive (McdClientProxy *self);
 G_GNUC_INTERNAL void _mcd_client_proxy_set_active (McdClientProxy *self,
                                                    const gchar *unique_name);
@@ -100,7 +116,18 @@ G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_bypass_approval
 G_GNUC_INTERNAL gboolean _mcd_client_proxy_get_delay_approvers
     (McdClientProxy *self);
 
-G_GNUC_INTERNAL GValueArray *_mcd_client_proxy_dup_handler_capabilities (
+G_GNUC_INTERNAL GValueArray *_mcd_client_proxy_get_handler_capabilities (
+    McdClientProxy *self);
+
+G_GNUC_INTERNAL gint _mcd_client_get_deadline (McdClientRoles role);
+G_GNUC_INTERNAL void _mcd_client_proxy_note_missed_deadline (
+    McdClientProxy *self);
+G_GNUC_INTERNAL void _mcd_client_proxy_note_reply (McdClientProxy *self,
+    const GError *error);
+G_GNUC_INTERNAL gboolean _mcd_client_proxy_is_degraded (McdClientProxy *self);
+G_GNUC_INTERNAL void _mcd_client_proxy_note_failure (McdClientProxy *self);
+G_GNUC_INTERNAL void _mcd_client_proxy_note_success (McdClientProxy *self);
+G_GNUC_INTERNAL gboolean _mcd_client_proxy_is_cooling_down (
     McdClientProxy *self);
 
 G_GNUC_INTERNAL void _mcd_client_proxy_inc_ready_lock (McdClientProxy *self);
@@ -119,7 +146,7 @@ G_GNUC_INTERNAL void _mcd_client_proxy_handle_channels (McdClientProxy *self,
     gpointer user_data, GDestroyNotify destroy, GObject *weak_object);
 
 G_GNUC_INTERNAL void _mcd_client_recover_observer (McdClientProxy *self,
-    TpChannel *channel, const gchar *account_path);
+    const GList *channels, const gchar *account_path);
 
 G_END_DECLS
 
@@ -28,6 +28,8 @@
 
 #include <errno.h>
 
+#include <dbus/dbus-glib.h>
+
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
@@ -35,6 +37,7 @@
 
 #include "channel-utils.h"
 #include "mcd-channel-priv.h"
+#include "mcd-client-files.h"
 #include "mcd-debug.h"
 
 G_DEFINE_TYPE (McdClientProxy, _mcd_client_proxy, TP_TYPE_CLIENT);
@@ -51,9 +54,13 @@ enum
 {
     S_READY,
     S_IS_HANDLING_CHANNEL,
+    S_HANDLED_CHANNELS_LISTED,
     S_HANDLER_CAPABILITIES_CHANGED,
     S_GONE,
     S_NEED_RECOVERY,
+    S_ROLES_CHANGED,
+    S_UNIQUE_NAME_CHANGED,
+    S_INTROSPECTION_WANTED,
     N_SIGNALS
 };
 
@@ -62,10 +69,19 @@ static guint signals[N_SIGNALS] = { 0 };
 struct _McdClientProxyPrivate
 {
     GStrv capability_tokens;
+    /* a HandlerCapabilities struct built from handler_filters and
+     * capability_tokens, or NULL if either has changed since it was last
+     * needed */
+    GValueArray *handler_capabilities;
 
     gchar *unique_name;
+    McdClientRoles roles;
     guint ready_lock;
     gboolean introspect_started;
+    /* TRUE if our capabilities came from a .client file */
+    gboolean has_client_file;
+    /* TRUE if we're waiting for _mcd_client_proxy_introspect_on_bus() */
+    gboolean bus_introspection_wanted;
     gboolean ready;
     gboolean bypass_approval;
     gboolean delay_approvers;
@@ -95,9 +111,36 @@ struct _McdClientProxyPrivate
     GList *handler_filters;
     GList *observer_filters;
 
+    /* TRUE if the last call we made to this client ran into our deadline
+     * rather than being answered; the dispatcher stops waiting for degraded
+     * clients. Reset when the client replies in time, or is replaced by a
+     * new process. */
+    gboolean degraded;
+    /* number of calls to this client that ran into our deadline, for
+     * debugging */
+    guint missed_deadlines;
+
+    /* number of calls to this client that have failed in a row, and the
+     * monotonic time until which the dispatcher should avoid it as a
+     * result. Reset when a call succeeds, or the client is replaced by a
+     * new process. */
+    guint consecutive_failures;
+    gint64 cool_down_until;
+
     gboolean disposed;
 };
 
+/* After a failure, avoid a Client for COOL_DOWN_BASE seconds, doubling with
+ * each further consecutive failure up to COOL_DOWN_MAX seconds */
+#define COOL_DOWN_BASE 1
+#define COOL_DOWN_MAX 300
+
+/* How long to wait for a Client in each role to reply, in milliseconds,
+ * unless overridden by the environment; -1 means the D-Bus default */
+#define DEFAULT_APPROVER_DEADLINE -1
+#define DEFAULT_HANDLER_DEADLINE -1
+#define DEFAULT_OBSERVER_DEADLINE -1
+
 typedef enum
 {
     MCD_CLIENT_APPROVER,
@@ -140,63 +183,233 @@ _mcd_client_proxy_dec_ready_lock (McdClientProxy *self)
     }
 }
 
-static void _mcd_client_proxy_take_approver_filters
-    (McdClientProxy *self, GList *filters);
-static void _mcd_client_proxy_take_observer_filters
-    (McdClientProxy *self, GList *filters);
-static void _mcd_client_proxy_take_handler_filters
-    (McdClientProxy *self, GList *filters);
+static gint
+deadline_from_env (const gchar *variable,
+                   gint default_ms)
+{
+    const gchar *str = g_getenv (variable);
+    gchar *end;
+    gint64 ms;
+
+    if (str == NULL)
+        return default_ms;
+
+    ms = g_ascii_strtoll (str, &end, 10);
 
-static gchar *
-_mcd_client_proxy_find_client_file (const gchar *client_name)
+    if (end == str || *end != '\0' || ms > G_MAXINT)
+    {
+        WARNING ("Ignoring invalid %s=%s", variable, str);
+        return default_ms;
+    }
+
+    /* zero or negative means "no deadline of our own" */
+    if (ms <= 0)
+        return -1;
+
+    return (gint) ms;
+}
+
+/*
+ * _mcd_client_get_deadline:
+ * @role: exactly one of the #McdClientRoles
+ *
+ * Returns: the timeout in milliseconds to use for method calls on clients
+ *  acting as @role, or -1 to use the D-Bus default
+ */
+gint
+_mcd_client_get_deadline (McdClientRoles role)
 {
-    const gchar * const *dirs;
-    const gchar *dirname;
-    const gchar *env_dirname;
-    gchar *filename, *absolute_filepath;
+    static gboolean initialized = FALSE;
+    static gint approver, handler, observer;
 
-    /*
-     * The full path is $XDG_DATA_DIRS/telepathy/clients/clientname.client
-     * or $XDG_DATA_HOME/telepathy/clients/clientname.client
-     * For testing purposes, we also look for $MC_CLIENTS_DIR/clientname.client
-     * if $MC_CLIENTS_DIR is set.
-     */
-    filename = g_strdup_printf ("%s.client", client_name);
-    env_dirname = g_getenv ("MC_CLIENTS_DIR");
-    if (env_dirname)
+    if (!initialized)
     {
-        absolute_filepath = g_build_filename (env_dirname, filename, NULL);
-        if (g_file_test (absolute_filepath, G_FILE_TEST_IS_REGULAR))
-            goto finish;
-        g_free (absolute_filepath);
+        approver = deadline_from_env ("MC_APPROVER_TIMEOUT",
+                                      DEFAULT_APPROVER_DEADLINE);
+        handler = deadline_from_env ("MC_HANDLER_TIMEOUT",
+                                     DEFAULT_HANDLER_DEADLINE);
+        observer = deadline_from_env ("MC_OBSERVER_TIMEOUT",
+                                      DEFAULT_OBSERVER_DEADLINE);
+        initialized = TRUE;
+
+        DEBUG ("approvers: %d ms, handlers: %d ms, observers: %d ms",
+               approver, handler, observer);
     }
 
-    dirname = g_get_user_data_dir ();
-    if (G_LIKELY (dirname))
+    switch (role)
+    {
+        case MCD_CLIENT_ROLE_APPROVER:
+            return approver;
+
+        case MCD_CLIENT_ROLE_HANDLER:
+            return handler;
+
+        case MCD_CLIENT_ROLE_OBSERVER:
+            return observer;
+
+        default:
+            g_return_val_if_reached (-1);
+    }
+}
+
+/*
+ * _mcd_client_proxy_note_missed_deadline:
+ * @self: a client
+ *
+ * Record that we gave up waiting for @self to answer a method call, and
+ * mark it as degraded until it next answers.
+ */
+void
+_mcd_client_proxy_note_missed_deadline (McdClientProxy *self)
+{
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+
+    self->priv->missed_deadlines++;
+    DEBUG ("%s missed a deadline (%u so far), marking it as degraded",
+           tp_proxy_get_bus_name (self), self->priv->missed_deadlines);
+    self->priv->degraded = TRUE;
+}
+
+static void
+note_reply_get_name_owner_cb (TpDBusDaemon *dbus_daemon,
+                              const gchar *owner,
+                              const GError *error,
+                              gpointer user_data,
+                              GObject *weak_object)
+{
+    McdClientProxy *self = MCD_CLIENT_PROXY (weak_object);
+    const gchar *unique_name = user_data;
+
+    /* NoReply is also what we get if the client exits without answering,
+     * in which case it is gone rather than slow, and its replacement (if
+     * any) deserves a fresh start */
+    if (error != NULL || tp_strdiff (owner, unique_name) ||
+        tp_strdiff (self->priv->unique_name, unique_name))
+    {
+        DEBUG ("%s exited without replying", tp_proxy_get_bus_name (self));
+        return;
+    }
+
+    _mcd_client_proxy_note_missed_deadline (self);
+}
+
+/*
+ * _mcd_client_proxy_note_reply:
+ * @self: a client
+ * @error: (allow-none): the error returned by a method call on @self
+ *
+ * Record whether a call to @self was answered in time. A client that runs
+ * into one of our deadlines becomes degraded until it next answers, unless
+ * it turns out to have exited instead.
+ */
+void
+_mcd_client_proxy_note_reply (McdClientProxy *self,
+                              const GError *error)
+{
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+
+    if (error != NULL && g_error_matches (error, DBUS_GERROR,
+                                          DBUS_GERROR_NO_REPLY))
     {
-        absolute_filepath = g_build_filename (dirname, "telepathy/clients",
-                                              filename, NULL);
-        if (g_file_test (absolute_filepath, G_FILE_TEST_IS_REGULAR))
-            goto finish;
-        g_free (absolute_filepath);
+        if (self->priv->unique_name == NULL ||
+            self->priv->unique_name[0] == '\0')
+            return;
+
+        /* the reply comes after any NameOwnerChanged for the client */
+        tp_cli_dbus_daemon_call_get_name_owner (
+            tp_proxy_get_dbus_daemon (self), -1, tp_proxy_get_bus_name (self),
+            note_reply_get_name_owner_cb, g_strdup (self->priv->unique_name),
+            g_free, (GObject *) self);
     }
+    else if (self->priv->degraded)
+    {
+        DEBUG ("%s replied in time, no longer degraded",
+               tp_proxy_get_bus_name (self));
+        self->priv->degraded = FALSE;
+    }
+}
+
+/*
+ * _mcd_client_proxy_note_failure:
+ * @self: a client
+ *
+ * Record that a call to @self failed, and start (or extend) a cool-down
+ * period during which the dispatcher prefers other clients.
+ */
+void
+_mcd_client_proxy_note_failure (McdClientProxy *self)
+{
+    gint64 cool_down = COOL_DOWN_MAX;
 
-    dirs = g_get_system_data_dirs ();
-    for (dirname = *dirs; dirname != NULL; dirs++, dirname = *dirs)
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+
+    self->priv->consecutive_failures++;
+
+    if (self->priv->consecutive_failures <= 9)
     {
-        absolute_filepath = g_build_filename (dirname, "telepathy/clients",
-                                              filename, NULL);
-        if (g_file_test (absolute_filepath, G_FILE_TEST_IS_REGULAR))
-            goto finish;
-        g_free (absolute_filepath);
+        cool_down = MIN (COOL_DOWN_MAX,
+            COOL_DOWN_BASE << (self->priv->consecutive_failures - 1));
     }
 
-    absolute_filepath = NULL;
-finish:
-    g_free (filename);
-    return absolute_filepath;
+    self->priv->cool_down_until = g_get_monotonic_time () +
+        cool_down * G_USEC_PER_SEC;
+
+    DEBUG ("%s failed %u times in a row, avoiding it for %" G_GINT64_FORMAT
+           "s", tp_proxy_get_bus_name (self),
+           self->priv->consecutive_failures, cool_down);
 }
 
+/*
+ * _mcd_client_proxy_note_success:
+ * @self: a client
+ *
+ * Record that a call to @self succeeded, ending any cool-down period.
+ */
+void
+_mcd_client_proxy_note_success (McdClientProxy *self)
+{
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+
+    if (self->priv->consecutive_failures > 0)
+        DEBUG ("%s succeeded, forgetting %u failures",
+               tp_proxy_get_bus_name (self),
+               self->priv->consecutive_failures);
+
+    self->priv->consecutive_failures = 0;
+    self->priv->cool_down_until = 0;
+}
+
+/*
+ * _mcd_client_proxy_is_cooling_down:
+ * @self: a client
+ *
+ * Returns: %TRUE if @self has failed recently enough that the dispatcher
+ *  should prefer other clients
+ */
+gboolean
+_mcd_client_proxy_is_cooling_down (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), FALSE);
+
+    return (self->priv->consecutive_failures > 0 &&
+            g_get_monotonic_time () < self->priv->cool_down_until);
+}
+
+gboolean
+_mcd_client_proxy_is_degraded (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), FALSE);
+
+    return self->priv->degraded;
+}
+
+static void _mcd_client_proxy_take_approver_filters
+    (McdClientProxy *self, GList *filters);
+static void _mcd_client_proxy_take_observer_filters
+    (McdClientProxy *self, GList *filters);
+static void _mcd_client_proxy_take_handler_filters
+    (McdClientProxy *self, GList *filters);
+
 static GHashTable *
 parse_client_filter (GKeyFile *file, const gchar *group)
 {
@@ -515,12 +728,28 @@ _mcd_client_proxy_set_cap_tokens (McdClientProxy *self,
 {
     g_strfreev (self->priv->capability_tokens);
     self->priv->capability_tokens = g_strdupv (cap_tokens);
+    tp_clear_pointer (&self->priv->handler_capabilities, g_value_array_free);
+}
+
+static void
+_mcd_client_proxy_set_roles (McdClientProxy *self,
+                             McdClientRoles roles)
+{
+    if (self->priv->roles == roles)
+        return;
+
+    DEBUG ("%s: roles 0x%x -> 0x%x", tp_proxy_get_bus_name (self),
+           self->priv->roles, roles);
+
+    self->priv->roles = roles;
+    g_signal_emit (self, signals[S_ROLES_CHANGED], 0);
 }
 
 static void
 _mcd_client_proxy_add_interfaces (McdClientProxy *self,
                                   const gchar * const *interfaces)
 {
+    McdClientRoles roles = MCD_CLIENT_ROLE_NONE;
     guint i;
 
     if (interfaces == NULL)
@@ -536,6 +765,17 @@ _mcd_client_proxy_add_interfaces (McdClientProxy *self,
             tp_proxy_add_interface_by_id ((TpProxy *) self, q);
         }
     }
+
+    if (tp_proxy_has_interface_by_id (self, TP_IFACE_QUARK_CLIENT_APPROVER))
+        roles |= MCD_CLIENT_ROLE_APPROVER;
+
+    if (tp_proxy_has_interface_by_id (self, TP_IFACE_QUARK_CLIENT_HANDLER))
+        roles |= MCD_CLIENT_ROLE_HANDLER;
+
+    if (tp_proxy_has_interface_by_id (self, TP_IFACE_QUARK_CLIENT_OBSERVER))
+        roles |= MCD_CLIENT_ROLE_OBSERVER;
+
+    _mcd_client_proxy_set_roles (self, roles);
 }
 
 static void
@@ -572,6 +812,14 @@ _mcd_client_proxy_is_activatable (McdClientProxy *self)
     return self->priv->activatable;
 }
 
+McdClientRoles
+_mcd_client_proxy_get_roles (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), MCD_CLIENT_ROLE_NONE);
+
+    return self->priv->roles;
+}
+
 const gchar *
 _mcd_client_proxy_get_unique_name (McdClientProxy *self)
 {
@@ -580,8 +828,11 @@ _mcd_client_proxy_get_unique_name (McdClientProxy *self)
     return self->priv->unique_name;
 }
 
+/*
+ * @channels: a #GList of #TpChannel, all belonging to the same connection
+ */
 void
-_mcd_client_recover_observer (McdClientProxy *self, TpChannel *channel,
+_mcd_client_recover_observer (McdClientProxy *self, const GList *channels,
     const gchar *account_path)
 {
     GPtrArray *satisfied_requests;
@@ -590,6 +841,8 @@ _mcd_client_recover_observer (McdClientProxy *self, TpChannel *channel,
     const gchar *connection_path;
     GPtrArray *channels_array;
 
+    g_return_if_fail (channels != NULL);
+
     satisfied_requests = g_ptr_array_new ();
     observer_info = g_hash_table_new (g_str_hash, g_str_equal);
     tp_asv_set_boolean (observer_info, "recovering", TRUE);
@@ -597,12 +850,12 @@ _mcd_client_recover_observer (McdClientProxy *self, TpChannel *channel,
         TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP,
         g_hash_table_new (NULL, NULL));
 
-    channels_array = _mcd_tp_channel_details_build_from_tp_chan (channel);
-    conn = tp_channel_get_connection (channel);
+    channels_array = _mcd_tp_channel_details_build_from_tp_chans (channels);
+    conn = tp_channel_get_connection (channels->data);
     connection_path = tp_proxy_get_object_path (conn);
 
-    DEBUG ("calling ObserveChannels on %s for channel %p",
-           tp_proxy_get_bus_name (self), channel);
+    DEBUG ("calling ObserveChannels on %s for %u channels",
+           tp_proxy_get_bus_name (self), channels_array->len);
 
     tp_cli_client_observer_call_observe_channels (
         (TpClient *) self, -1, account_path,
@@ -690,6 +943,9 @@ _mcd_client_proxy_handler_get_all_cb (TpProxy *proxy,
 
                 g_signal_emit (self, signals[S_IS_HANDLING_CHANNEL], 0, path);
             }
+
+            g_signal_emit (self, signals[S_HANDLED_CHANNELS_LISTED], 0,
+                           handled_channels);
         }
     }
 
@@ -851,36 +1107,94 @@ finally:
 static gboolean
 _mcd_client_proxy_parse_client_file (McdClientProxy *self)
 {
-    gboolean file_found = FALSE;
-    gchar *filename;
+    GKeyFile *file;
+    GError *error = NULL;
     const gchar *bus_name = tp_proxy_get_bus_name (self);
+    const gchar *client_name = bus_name + MC_CLIENT_BUS_NAME_BASE_LEN;
 
-    filename = _mcd_client_proxy_find_client_file (
-        bus_name + MC_CLIENT_BUS_NAME_BASE_LEN);
+    file = _mcd_client_files_load (client_name, &error);
 
-    if (filename)
+    if (file == NULL)
     {
-        GKeyFile *file;
-        GError *error = NULL;
-
-        file = g_key_file_new ();
-        g_key_file_load_from_file (file, filename, 0, &error);
-        if (G_LIKELY (!error))
+        if (error != NULL)
         {
-            DEBUG ("File found for %s: %s", bus_name, filename);
-            parse_client_file (self, file);
-            file_found = TRUE;
-        }
-        else
-        {
-            g_warning ("Loading file %s failed: %s", filename, error->message);
+            g_warning ("Loading .client file for %s failed: %s", bus_name,
+                       error->message);
             g_error_free (error);
         }
-        g_key_file_free (file);
-        g_free (filename);
+
+        return FALSE;
     }
 
-    return file_found;
+    DEBUG ("File found for %s", bus_name);
+    parse_client_file (self, file);
+    self->priv->has_client_file = TRUE;
+    g_key_file_unref (file);
+    return TRUE;
+}
+
+/*
+ * mcd_client_proxy_want_bus_introspection:
+ *
+ * Ask the client registry to call _mcd_client_proxy_introspect_on_bus()
+ * when it's our turn to make D-Bus calls. We are not ready until it has
+ * been called, and the calls it makes have returned.
+ */
+static void
+mcd_client_proxy_want_bus_introspection (McdClientProxy *self)
+{
+    _mcd_client_proxy_inc_ready_lock (self);
+    self->priv->bus_introspection_wanted = TRUE;
+
+    g_signal_emit (self, signals[S_INTROSPECTION_WANTED], 0);
+
+    /* if nobody is scheduling introspection, just get on with it */
+    if (self->priv->bus_introspection_wanted &&
+        !g_signal_has_handler_pending (self,
+            signals[S_INTROSPECTION_WANTED], 0, FALSE))
+    {
+        _mcd_client_proxy_introspect_on_bus (self);
+    }
+}
+
+/*
+ * _mcd_client_proxy_introspect_on_bus:
+ * @self: a client that has emitted #McdClientProxy::introspection-wanted
+ *
+ * Make the D-Bus calls needed to finish introspecting @self: the Client
+ * properties if it has no .client file, or the Handler properties (to find
+ * out which channels it is handling) if it's a running Handler. @self will
+ * emit #McdClientProxy::ready when they have all returned.
+ */
+void
+_mcd_client_proxy_introspect_on_bus (McdClientProxy *self)
+{
+    g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
+    g_return_if_fail (self->priv->bus_introspection_wanted);
+
+    self->priv->bus_introspection_wanted = FALSE;
+
+    if (self->priv->has_client_file)
+    {
+        tp_cli_dbus_properties_call_get_all (self, -1,
+            TP_IFACE_CLIENT_HANDLER,
+            _mcd_client_proxy_handler_get_all_cb,
+            NULL, NULL, NULL);
+    }
+    else
+    {
+        tp_cli_dbus_properties_call_get (self, -1,
+            TP_IFACE_CLIENT, "Interfaces", _mcd_client_proxy_get_interfaces_cb,
+            NULL, NULL, NULL);
+    }
+}
+
+gboolean
+_mcd_client_proxy_has_client_file (McdClientProxy *self)
+{
+    g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), FALSE);
+
+    return self->priv->has_client_file;
 }
 
 static gboolean
@@ -904,11 +1218,7 @@ mcd_client_proxy_introspect (gpointer data)
     {
         DEBUG ("No .client file for %s. Ask on D-Bus.", bus_name);
 
-        _mcd_client_proxy_inc_ready_lock (self);
-
-        tp_cli_dbus_properties_call_get (self, -1,
-            TP_IFACE_CLIENT, "Interfaces", _mcd_client_proxy_get_interfaces_cb,
-            NULL, NULL, NULL);
+        mcd_client_proxy_want_bus_introspection (self);
     }
     else
     {
@@ -919,13 +1229,7 @@ mcd_client_proxy_introspect (gpointer data)
                 DEBUG ("%s is an active, activatable Handler", bus_name);
 
                 /* We need to investigate whether it is handling any channels */
-
-                _mcd_client_proxy_inc_ready_lock (self);
-
-                tp_cli_dbus_properties_call_get_all (self, -1,
-                    TP_IFACE_CLIENT_HANDLER,
-                    _mcd_client_proxy_handler_get_all_cb,
-                    NULL, NULL, NULL);
+                mcd_client_proxy_want_bus_introspection (self);
             }
             else
             {
@@ -1116,6 +1420,17 @@ _mcd_client_proxy_class_init (McdClientProxyClass *klass)
         g_cclosure_marshal_VOID__STRING,
         G_TYPE_NONE, 1, G_TYPE_STRING);
 
+    /* Emitted once per HandledChannels result, after is-handling-channel
+     * has been emitted for each of its paths; the argument is the
+     * complete list, as a GPtrArray of object paths */
+    signals[S_HANDLED_CHANNELS_LISTED] = g_signal_new (
+        "handled-channels-listed",
+        G_OBJECT_CLASS_TYPE (klass),
+        G_SIGNAL_RUN_LAST,
+        0, NULL, NULL,
+        g_cclosure_marshal_VOID__POINTER,
+        G_TYPE_NONE, 1, G_TYPE_POINTER);
+
     /* Never emitted until after the unique name is known */
     signals[S_HANDLER_CAPABILITIES_CHANGED] = g_signal_new (
         "handler-capabilities-changed",
@@ -1132,6 +1447,33 @@ _mcd_client_proxy_class_init (McdClientProxyClass *klass)
         g_cclosure_marshal_VOID__VOID,
         G_TYPE_NONE, 0);
 
+    /* Emitted when the Client interfaces we dispatch to change; see
+     * _mcd_client_proxy_get_roles() */
+    signals[S_ROLES_CHANGED] = g_signal_new ("roles-changed",
+        G_OBJECT_CLASS_TYPE (klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+        0, NULL, NULL,
+        g_cclosure_marshal_VOID__VOID,
+        G_TYPE_NONE, 0);
+
+    /* Emitted when the client needs to make D-Bus calls to finish
+     * introspection; whoever handles it must eventually call
+     * _mcd_client_proxy_introspect_on_bus() */
+    signals[S_INTROSPECTION_WANTED] = g_signal_new ("introspection-wanted",
+        G_OBJECT_CLASS_TYPE (klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+        0, NULL, NULL,
+        g_cclosure_marshal_VOID__VOID,
+        G_TYPE_NONE, 0);
+
+    /* The argument is the previous unique name, which may be NULL or "" */
+    signals[S_UNIQUE_NAME_CHANGED] = g_signal_new ("unique-name-changed",
+        G_OBJECT_CLASS_TYPE (klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+        0, NULL, NULL,
+        g_cclosure_marshal_VOID__STRING,
+        G_TYPE_NONE, 1, G_TYPE_STRING);
+
     g_object_class_install_property (object_class, PROP_ACTIVATABLE,
         g_param_spec_boolean ("activatable", "Activatable?",
             "TRUE if this client can be service-activated", FALSE,
@@ -1243,6 +1585,8 @@ static void _mcd_client_proxy_become_incapable (McdClientProxy *self);
 void
 _mcd_client_proxy_set_inactive (McdClientProxy *self)
 {
+    gchar *old_unique_name;
+
     g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
 
     /* if unique name is already "" (i.e. known to be inactive), do nothing */
@@ -1251,8 +1595,10 @@ _mcd_client_proxy_set_inactive (McdClientProxy *self)
         return;
     }
 
-    g_free (self->priv->unique_name);
+    old_unique_name = self->priv->unique_name;
     self->priv->unique_name = g_strdup ("");
+    g_signal_emit (self, signals[S_UNIQUE_NAME_CHANGED], 0, old_unique_name);
+    g_free (old_unique_name);
 
     if (!self->priv->activatable)
     {
@@ -1269,11 +1615,22 @@ void
 _mcd_client_proxy_set_active (McdClientProxy *self,
                               const gchar *unique_name)
 {
+    gchar *old_unique_name;
+
     g_return_if_fail (MCD_IS_CLIENT_PROXY (self));
     g_return_if_fail (unique_name != NULL);
 
-    g_free (self->priv->unique_name);
+    if (!tp_strdiff (self->priv->unique_name, unique_name))
+        return;
+
+    old_unique_name = self->priv->unique_name;
     self->priv->unique_name = g_strdup (unique_name);
+    /* a new process deserves a fresh start */
+    self->priv->degraded = FALSE;
+    self->priv->consecutive_failures = 0;
+    self->priv->cool_down_until = 0;
+    g_signal_emit (self, signals[S_UNIQUE_NAME_CHANGED], 0, old_unique_name);
+    g_free (old_unique_name);
 }
 
 void
@@ -1349,6 +1706,7 @@ _mcd_client_proxy_take_handler_filters (McdClientProxy *self,
 
     mcd_client_proxy_free_client_filters (&(self->priv->handler_filters));
     self->priv->handler_filters = filters;
+    tp_clear_pointer (&self->priv->handler_capabilities, g_value_array_free);
 }
 
 gboolean
@@ -1381,7 +1739,11 @@ _mcd_client_proxy_become_incapable (McdClientProxy *self)
     _mcd_client_proxy_take_approver_filters (self, NULL);
     _mcd_client_proxy_take_observer_filters (self, NULL);
     _mcd_client_proxy_take_handler_filters (self, NULL);
-    tp_clear_pointer (&self->priv->capability_tokens, g_strfreev);
+    _mcd_client_proxy_set_cap_tokens (self, NULL);
+
+    /* we can't take interfaces away from a TpProxy, but we can stop
+     * dispatching to it */
+    _mcd_client_proxy_set_roles (self, MCD_CLIENT_ROLE_NONE);
 
     if (handler_was_capable)
     {
@@ -1389,8 +1751,16 @@ _mcd_client_proxy_become_incapable (McdClientProxy *self)
     }
 }
 
+/*
+ * _mcd_client_proxy_get_handler_capabilities:
+ * @self: a client
+ *
+ * Returns: (transfer none): a HandlerCapabilities struct describing @self,
+ *  suitable for UpdateCapabilities, which remains valid until @self's
+ *  handler filters or capability tokens change
+ */
 GValueArray *
-_mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
+_mcd_client_proxy_get_handler_capabilities (McdClientProxy *self)
 {
     GPtrArray *filters;
     GStrv cap_tokens;
@@ -1400,6 +1770,9 @@ _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
 
     g_return_val_if_fail (MCD_IS_CLIENT_PROXY (self), NULL);
 
+    if (self->priv->handler_capabilities != NULL)
+        return self->priv->handler_capabilities;
+
     filters = g_ptr_array_sized_new (
         g_list_length (self->priv->handler_filters));
 
@@ -1449,6 +1822,7 @@ _mcd_client_proxy_dup_handler_capabilities (McdClientProxy *self)
     g_value_take_boxed (va->values + 1, filters);
     g_value_set_boxed (va->values + 2, cap_tokens);
 
+    self->priv->handler_capabilities = va;
     return va;
 }
 
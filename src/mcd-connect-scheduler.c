@@ -0,0 +1,361 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Staggered, rate-limited connection attempts.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include "mcd-connect-scheduler.h"
+
+#include <stdlib.h>
+
+#include "mcd-account-priv.h"
+#include "mcd-debug.h"
+#include "mcd-timer-wheel.h"
+
+/*
+ * Connection attempts that the user didn't directly ask for (automatic
+ * connection at startup, or when the network comes back) are queued here
+ * rather than all being started at once, which would hammer connection
+ * managers and servers.
+ *
+ * Queued attempts are started one at a time, a random STAGGER_MIN_MS to
+ * STAGGER_MAX_MS apart, accounts the user used most recently first. No
+ * more than max_attempts () attempts are in progress at once, and no more
+ * than MAX_ATTEMPTS_PER_CM for the same connection manager. An attempt is
+ * in progress from when it is started until the account is connected or
+ * disconnected, or for ATTEMPT_TIMEOUT_MS if that takes longer: a
+ * connection that never gets anywhere mustn't hold up everyone else.
+ */
+#define STAGGER_MIN_MS 10
+#define STAGGER_MAX_MS 250
+#define DEFAULT_MAX_ATTEMPTS 8
+#define MAX_ATTEMPTS_PER_CM 4
+#define ATTEMPT_TIMEOUT_MS (60 * 1000)
+
+typedef struct {
+    /* owned */
+    gchar *manager;
+    /* source ID for attempt_timeout_cb, or 0 */
+    guint timeout_id;
+} Attempt;
+
+/* ref'd McdAccount, in the order they were queued */
+static GQueue waiting = G_QUEUE_INIT;
+/* ref'd McdAccount => owned Attempt */
+static GHashTable *in_progress = NULL;
+/* owned gchar * manager name => number of attempts in progress, as a
+ * GUINT_TO_POINTER */
+static GHashTable *per_cm = NULL;
+/* owned gchar * account unique name => time of last user activity, in
+ * seconds, as a GUINT_TO_POINTER */
+static GHashTable *activity = NULL;
+/* source ID for release_cb, or 0 */
+static guint release_id = 0;
+
+static void schedule_release (void);
+
+static void
+attempt_free (gpointer p)
+{
+    Attempt *attempt = p;
+
+    if (attempt->timeout_id != 0)
+        _mcd_timer_wheel_remove (attempt->timeout_id);
+
+    g_free (attempt->manager);
+    g_slice_free (Attempt, attempt);
+}
+
+static guint
+max_attempts (void)
+{
+    static gint max = -1;
+
+    if (max < 0)
+    {
+        const gchar *s = g_getenv ("MC_MAX_CONNECTION_ATTEMPTS");
+
+        max = (s == NULL ? DEFAULT_MAX_ATTEMPTS : MAX (0, atoi (s)));
+    }
+
+    /* 0 means no limit */
+    return (max == 0 ? G_MAXUINT : (guint) max);
+}
+
+static void
+ensure_tables (void)
+{
+    if (G_LIKELY (in_progress != NULL))
+        return;
+
+    in_progress = g_hash_table_new_full (NULL, NULL, g_object_unref,
+                                         attempt_free);
+    per_cm = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    activity = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static guint
+get_cm_attempts (const gchar *manager)
+{
+    return GPOINTER_TO_UINT (g_hash_table_lookup (per_cm, manager));
+}
+
+static void
+set_cm_attempts (const gchar *manager,
+                 guint n)
+{
+    if (n == 0)
+        g_hash_table_remove (per_cm, manager);
+    else
+        g_hash_table_insert (per_cm, g_strdup (manager), GUINT_TO_POINTER (n));
+}
+
+static guint
+get_activity (McdAccount *account)
+{
+    return GPOINTER_TO_UINT (g_hash_table_lookup (activity,
+        mcd_account_get_unique_name (account)));
+}
+
+static gboolean
+attempt_timeout_cb (gpointer data)
+{
+    McdAccount *account = data;
+    Attempt *attempt = g_hash_table_lookup (in_progress, account);
+
+    g_return_val_if_fail (attempt != NULL, FALSE);
+    attempt->timeout_id = 0;
+
+    DEBUG ("%s is taking too long to connect, letting someone else start",
+           mcd_account_get_unique_name (account));
+    _mcd_connect_scheduler_attempt_finished (account);
+    return FALSE;
+}
+
+static void
+start_attempt (McdAccount *account)
+{
+    const gchar *manager = mcd_account_get_manager_name (account);
+    Attempt *attempt = g_slice_new0 (Attempt);
+
+    attempt->manager = g_strdup (manager);
+    /* the account is kept alive by in_progress for as long as this
+     * timeout can fire */
+    attempt->timeout_id = _mcd_timer_wheel_add (ATTEMPT_TIMEOUT_MS, 0,
+                                                attempt_timeout_cb, account);
+    g_hash_table_insert (in_progress, g_object_ref (account), attempt);
+    set_cm_attempts (manager, get_cm_attempts (manager) + 1);
+
+    DEBUG ("starting %s (%u in progress)",
+           mcd_account_get_unique_name (account),
+           g_hash_table_size (in_progress));
+
+    /* the account might decide not to connect after all, for instance if
+     * we have gone offline since it was queued */
+    if (!_mcd_account_connection_scheduled (account))
+        _mcd_connect_scheduler_attempt_finished (account);
+}
+
+/*
+ * Returns: (transfer none): the link for the most recently used waiting
+ *  account whose connection manager isn't too busy, or %NULL
+ */
+static GList *
+find_next (void)
+{
+    GList *best = NULL;
+    guint best_activity = 0;
+    GList *link;
+
+    if (g_hash_table_size (in_progress) >= max_attempts ())
+        return NULL;
+
+    for (link = waiting.head; link != NULL; link = link->next)
+    {
+        McdAccount *account = link->data;
+        guint a;
+
+        if (get_cm_attempts (mcd_account_get_manager_name (account)) >=
+            MAX_ATTEMPTS_PER_CM)
+            continue;
+
+        a = get_activity (account);
+
+        if (best == NULL || a > best_activity)
+        {
+            best = link;
+            best_activity = a;
+        }
+    }
+
+    return best;
+}
+
+static gboolean
+release_cb (gpointer data G_GNUC_UNUSED)
+{
+    GList *link;
+
+    release_id = 0;
+    link = find_next ();
+
+    if (link != NULL)
+    {
+        McdAccount *account = link->data;
+
+        g_queue_delete_link (&waiting, link);
+        start_attempt (account);
+        g_object_unref (account);
+    }
+
+    schedule_release ();
+    return FALSE;
+}
+
+static void
+schedule_release (void)
+{
+    if (release_id != 0 || find_next () == NULL)
+        return;
+
+    release_id = _mcd_timer_wheel_add (
+        g_random_int_range (STAGGER_MIN_MS, STAGGER_MAX_MS + 1), 0,
+        release_cb, NULL);
+}
+
+/*
+ * _mcd_connect_scheduler_enqueue:
+ * @account: an account that wants to connect
+ *
+ * Arrange for _mcd_account_connection_scheduled() to be called on @account
+ * when it is its turn to connect.
+ */
+void
+_mcd_connect_scheduler_enqueue (McdAccount *account)
+{
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+
+    ensure_tables ();
+
+    if (g_queue_find (&waiting, account) != NULL)
+        return;
+
+    DEBUG ("%s (%u already waiting)", mcd_account_get_unique_name (account),
+           g_queue_get_length (&waiting));
+    g_queue_push_tail (&waiting, g_object_ref (account));
+    schedule_release ();
+}
+
+/*
+ * _mcd_connect_scheduler_hurry:
+ * @account: an account
+ *
+ * If @account is waiting for its turn, let it connect now: the user is
+ * waiting for it.
+ */
+void
+_mcd_connect_scheduler_hurry (McdAccount *account)
+{
+    GList *link;
+
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+
+    link = g_queue_find (&waiting, account);
+
+    if (link == NULL)
+        return;
+
+    DEBUG ("%s", mcd_account_get_unique_name (account));
+    g_queue_delete_link (&waiting, link);
+    start_attempt (account);
+    g_object_unref (account);
+}
+
+/*
+ * _mcd_connect_scheduler_cancel:
+ * @account: an account that is going away
+ *
+ * Forget about @account, whether it is waiting or connecting, and forget
+ * when the user last used it.
+ */
+void
+_mcd_connect_scheduler_cancel (McdAccount *account)
+{
+    GList *link = g_queue_find (&waiting, account);
+
+    if (link != NULL)
+    {
+        g_queue_delete_link (&waiting, link);
+        g_object_unref (account);
+    }
+
+    if (activity != NULL && mcd_account_get_unique_name (account) != NULL)
+        g_hash_table_remove (activity, mcd_account_get_unique_name (account));
+
+    _mcd_connect_scheduler_attempt_finished (account);
+}
+
+/*
+ * _mcd_connect_scheduler_attempt_finished:
+ * @account: an account
+ *
+ * Record that @account has finished trying to connect, successfully or
+ * otherwise, so that another account can have its turn.
+ */
+void
+_mcd_connect_scheduler_attempt_finished (McdAccount *account)
+{
+    Attempt *attempt;
+
+    if (in_progress == NULL ||
+        !g_hash_table_lookup_extended (in_progress, account, NULL,
+                                       (gpointer *) &attempt))
+        return;
+
+    set_cm_attempts (attempt->manager,
+                     get_cm_attempts (attempt->manager) - 1);
+    /* frees attempt, and might drop the last ref to account */
+    g_hash_table_remove (in_progress, account);
+
+    schedule_release ();
+}
+
+/*
+ * _mcd_connect_scheduler_note_user_activity:
+ * @account: an account
+ *
+ * Record that the user has just done something with @account, so that it
+ * will be reconnected before accounts the user hasn't used for a while.
+ */
+void
+_mcd_connect_scheduler_note_user_activity (McdAccount *account)
+{
+    guint now = g_get_monotonic_time () / G_USEC_PER_SEC + 1;
+
+    g_return_if_fail (MCD_IS_ACCOUNT (account));
+
+    ensure_tables ();
+    g_hash_table_insert (activity,
+                         g_strdup (mcd_account_get_unique_name (account)),
+                         GUINT_TO_POINTER (now));
+}
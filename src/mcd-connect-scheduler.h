@@ -0,0 +1,42 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Staggered, rate-limited connection attempts.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef MCD_CONNECT_SCHEDULER_H_
+#define MCD_CONNECT_SCHEDULER_H_
+
+#include "mcd-account.h"
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL void _mcd_connect_scheduler_enqueue (McdAccount *account);
+G_GNUC_INTERNAL void _mcd_connect_scheduler_hurry (McdAccount *account);
+G_GNUC_INTERNAL void _mcd_connect_scheduler_cancel (McdAccount *account);
+G_GNUC_INTERNAL void _mcd_connect_scheduler_attempt_finished (
+    McdAccount *account);
+G_GNUC_INTERNAL void _mcd_connect_scheduler_note_user_activity (
+    McdAccount *account);
+
+G_END_DECLS
+
+#endif
@@ -41,6 +41,13 @@ G_GNUC_INTERNAL
 void _mcd_connection_set_tp_connection (McdConnection *connection,
                                         const gchar *bus_name,
                                         const gchar *obj_path, GError **error);
+G_GNUC_INTERNAL
+gboolean _mcd_connection_attach_tp_connection (McdConnection *connection,
+                                               const gchar *bus_name,
+                                               const gchar *obj_path,
+                                               GError **error);
+G_GNUC_INTERNAL
+void _mcd_connection_prepare_tp_connection (McdConnection *connection);
 
 G_GNUC_INTERNAL void _mcd_connection_start_dispatching (McdConnection *self,
     GPtrArray *client_caps);
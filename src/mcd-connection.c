@@ -63,11 +63,39 @@
 #include "mcd-channel.h"
 #include "mcd-misc.h"
 #include "mcd-slacker.h"
+#include "mcd-timer-wheel.h"
 #include "sp_timestamp.h"
 
 #define INITIAL_RECONNECTION_TIME   3 /* seconds */
 #define RECONNECTION_MULTIPLIER     3
 #define MAXIMUM_RECONNECTION_TIME   30 * 60 /* half an hour */
+/* each reconnection delay is randomly adjusted by up to 1/N of itself, so
+ * that connections dropped at the same time don't all come back at once */
+#define RECONNECTION_JITTER         4
+/* reconnection attempts may be postponed by this much, so that they can
+ * share a wakeup with other timeouts */
+#define RECONNECTION_SLACK_MS       500
+
+/* Phases of bringing up a connection, each timed from the end of the
+ * previous one */
+typedef enum {
+    /* RequestConnection called -> returned */
+    MCD_CONNECTION_PHASE_REQUEST,
+    /* RequestConnection returned -> Connect called */
+    MCD_CONNECTION_PHASE_PREPARE,
+    /* Connect called -> status is CONNECTED */
+    MCD_CONNECTION_PHASE_CONNECT,
+    /* CONNECTED -> TpConnection prepared and set up */
+    MCD_CONNECTION_PHASE_READY,
+    MCD_CONNECTION_N_PHASES
+} McdConnectionPhase;
+
+static const gchar * const phase_names[MCD_CONNECTION_N_PHASES] = {
+    "request",
+    "prepare",
+    "connect",
+    "ready"
+};
 
 #define MCD_CONNECTION_PRIV(mcdconn) (MCD_CONNECTION (mcdconn)->priv)
 
@@ -94,6 +122,13 @@ struct _McdConnectionPrivate
     /* Things to do before calling Connect */
     guint tasks_before_connect;
 
+    /* When the current phase of bringing up the connection started, and
+     * when the first phase started; 0 if not connecting */
+    gint64 phase_start;
+    gint64 attempt_start;
+    /* How long each phase took, in microseconds */
+    gint64 phase_us[MCD_CONNECTION_N_PHASES];
+
     guint reconnect_timer; 	/* timer for reconnection */
     guint reconnect_interval;
     guint probation_timer;      /* for mcd_connection_probation_ended_cb */
@@ -110,6 +145,8 @@ struct _McdConnectionPrivate
 
     /* FALSE until the dispatcher has said it's ready for us */
     guint dispatching_started : 1;
+    /* FALSE until we have given ourselves to the dispatcher */
+    guint added_to_dispatcher : 1;
     /* FALSE until channels announced by NewChannel/NewChannels need to be
      * dispatched */
     guint dispatched_initial_channels : 1;
@@ -264,7 +301,7 @@ _mcd_connection_attempt (McdConnection *connection)
 
     if (connection->priv->reconnect_timer != 0)
     {
-        g_source_remove (connection->priv->reconnect_timer);
+        _mcd_timer_wheel_remove (connection->priv->reconnect_timer);
         connection->priv->reconnect_timer = 0;
     }
 
@@ -335,6 +372,48 @@ _mcd_connection_set_presence (McdConnection * connection,
     }
 }
 
+static void
+mcd_connection_start_phases (McdConnection *self)
+{
+    McdConnectionPrivate *priv = self->priv;
+
+    priv->attempt_start = priv->phase_start = g_get_monotonic_time ();
+    memset (priv->phase_us, 0, sizeof (priv->phase_us));
+}
+
+/* Record that @phase of bringing up the connection has finished. */
+static void
+mcd_connection_end_phase (McdConnection *self,
+                          McdConnectionPhase phase)
+{
+    McdConnectionPrivate *priv = self->priv;
+    gint64 now;
+
+    if (priv->phase_start == 0)
+        return;
+
+    now = g_get_monotonic_time ();
+    priv->phase_us[phase] = now - priv->phase_start;
+    priv->phase_start = now;
+
+    DEBUG ("%s: %s took %" G_GINT64_FORMAT " us",
+           mcd_account_get_unique_name (priv->account), phase_names[phase],
+           priv->phase_us[phase]);
+
+    if (phase == MCD_CONNECTION_PHASE_READY)
+    {
+        DEBUG ("%s: online after %" G_GINT64_FORMAT " us (request %"
+               G_GINT64_FORMAT ", prepare %" G_GINT64_FORMAT ", connect %"
+               G_GINT64_FORMAT ", ready %" G_GINT64_FORMAT ")",
+               mcd_account_get_unique_name (priv->account),
+               now - priv->attempt_start,
+               priv->phase_us[MCD_CONNECTION_PHASE_REQUEST],
+               priv->phase_us[MCD_CONNECTION_PHASE_PREPARE],
+               priv->phase_us[MCD_CONNECTION_PHASE_CONNECT],
+               priv->phase_us[MCD_CONNECTION_PHASE_READY]);
+        priv->phase_start = 0;
+    }
+}
 
 static void
 presence_get_statuses_cb (TpProxy *proxy, const GValue *v_statuses,
@@ -477,7 +556,7 @@ _mcd_connection_request_presence (McdConnection *self,
         /* if a reconnection attempt is scheduled, cancel it */
         if (self->priv->reconnect_timer)
         {
-            g_source_remove (self->priv->reconnect_timer);
+            _mcd_timer_wheel_remove (self->priv->reconnect_timer);
             self->priv->reconnect_timer = 0;
         }
     }
@@ -527,6 +606,8 @@ mcd_connection_reconnect (McdConnection *connection)
  * that never reached CONNECTED state don't count towards this limit, so we'll
  * keep retrying indefinitely for those (with exponential back-off). */
 #define PROBATION_MAX_DROPPED 3
+/* The end of probation doesn't need to be precise */
+#define PROBATION_SLACK_MS 5000
 
 static gboolean
 mcd_connection_probation_ended_cb (gpointer user_data)
@@ -581,12 +662,15 @@ on_connection_status_changed (TpConnection *tp_conn, GParamSpec *pspec,
         {
             g_signal_emit (connection, signals[CONNECTION_STATUS_CHANGED], 0,
                            conn_status, conn_reason, tp_conn, NULL, NULL);
+            mcd_connection_end_phase (connection,
+                                      MCD_CONNECTION_PHASE_CONNECT);
 
             if (priv->probation_timer == 0)
             {
                 DEBUG ("setting probation timer (%d) seconds, for %s",
                        PROBATION_SEC, tp_proxy_get_object_path (tp_conn));
-                priv->probation_timer = g_timeout_add_seconds (PROBATION_SEC,
+                priv->probation_timer = _mcd_timer_wheel_add (
+                    PROBATION_SEC * 1000, PROBATION_SLACK_MS,
                     mcd_connection_probation_ended_cb, connection);
                 priv->probation_drop_count = 0;
             }
@@ -727,10 +811,15 @@ mcd_connection_invalidated_cb (TpConnection *tp_conn,
          * abort the connection but try to reconnect later */
         if (priv->reconnect_timer == 0)
         {
-            DEBUG ("Preparing for reconnection in %u seconds",
-                priv->reconnect_interval);
-            priv->reconnect_timer = g_timeout_add_seconds
-                (priv->reconnect_interval,
+            guint delay_ms = priv->reconnect_interval * 1000;
+            guint jitter_ms = delay_ms / RECONNECTION_JITTER;
+
+            delay_ms += g_random_int_range (0, 2 * jitter_ms + 1);
+            delay_ms -= jitter_ms;
+
+            DEBUG ("Preparing for reconnection in %u ms", delay_ms);
+            priv->reconnect_timer = _mcd_timer_wheel_add
+                (delay_ms, RECONNECTION_SLACK_MS,
                  (GSourceFunc)mcd_connection_reconnect, connection);
             priv->reconnect_interval *= RECONNECTION_MULTIPLIER;
 
@@ -898,7 +987,14 @@ on_new_channels (TpConnection *proxy, const GPtrArray *channels,
     }
 }
 
-static void
+/*
+ * Make a McdChannel for a channel that was already present on the
+ * connection before MC started. The caller is responsible for passing it
+ * to the dispatcher.
+ *
+ * Returns: (transfer none): the new channel, or %NULL
+ */
+static McdChannel *
 mcd_connection_recover_channel (McdConnection *connection,
                                 const gchar *object_path,
                                 const GHashTable *properties)
@@ -909,52 +1005,34 @@ mcd_connection_recover_channel (McdConnection *connection,
     DEBUG ("called for %s", object_path);
     channel = mcd_channel_new_from_properties (priv->tp_conn, object_path,
                                                properties);
-    if (G_UNLIKELY (!channel)) return;
+    if (G_UNLIKELY (!channel)) return NULL;
 
     mcd_operation_take_mission (MCD_OPERATION (connection),
                                 MCD_MISSION (channel));
-
-    _mcd_dispatcher_recover_channel (priv->dispatcher, channel,
-      mcd_account_get_object_path (priv->account));
+    return channel;
 }
 
-static void
-mcd_connection_found_channel (McdConnection *self,
-                              const gchar *object_path,
-                              GHashTable *channel_props)
+/*
+ * Returns: (transfer full): a set containing the object path of each
+ *  channel we already have a McdChannel for
+ */
+static GHashTable *
+mcd_connection_dup_channel_paths (McdConnection *self)
 {
+    GHashTable *paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, NULL);
     const GList *list;
-    gboolean found = FALSE;
 
-    /* find the McdChannel */
-    /* NOTE: we cannot move the mcd_operation_get_missions() call out of
-     * the loop, because mcd_dispatcher_send() can cause the channel to be
-     * destroyed, at which point our list would contain a finalized channel
-     * (and a crash will happen) */
     list = mcd_operation_get_missions ((McdOperation *) self);
     for (; list != NULL; list = list->next)
     {
-        McdChannel *channel = MCD_CHANNEL (list->data);
-
-        if (g_strcmp0 (object_path,
-                       mcd_channel_get_object_path (channel)) == 0)
-        {
-            found = TRUE;
-            break;
-        }
+        const gchar *path = mcd_channel_get_object_path (list->data);
 
-        if (mcd_channel_get_status (channel) !=
-            MCD_CHANNEL_STATUS_UNDISPATCHED)
-            continue;
+        if (path != NULL)
+            g_hash_table_add (paths, g_strdup (path));
     }
 
-    if (!found)
-    {
-        /* We don't have a McdChannel for this channel, which most likely
-         * means that it was already present on the connection before MC
-         * started. Let's try to recover it */
-        mcd_connection_recover_channel (self, object_path, channel_props);
-    }
+    return paths;
 }
 
 static void get_all_requests_cb (TpProxy *proxy, GHashTable *properties,
@@ -964,6 +1042,8 @@ static void get_all_requests_cb (TpProxy *proxy, GHashTable *properties,
     McdConnection *connection = MCD_CONNECTION (weak_object);
     McdConnectionPrivate *priv = user_data;
     GPtrArray *channels;
+    GPtrArray *recovered;
+    GHashTable *known;
     GValue *value;
     guint i;
 
@@ -990,12 +1070,20 @@ static void get_all_requests_cb (TpProxy *proxy, GHashTable *properties,
         return;
     }
 
+    /* Look up all the channels we already know about once, rather than
+     * once per channel. The McdChannels for the others are all created
+     * before any of them is passed to the dispatcher, which could destroy
+     * channels and so change our list of missions. */
+    known = mcd_connection_dup_channel_paths (connection);
+    recovered = g_ptr_array_new_with_free_func (g_object_unref);
+
     channels = g_value_get_boxed (value);
     for (i = 0; i < channels->len; i++)
     {
         GValueArray *va;
         const gchar *object_path;
         GHashTable *channel_props;
+        McdChannel *channel;
 
         va = g_ptr_array_index (channels, i);
         object_path = g_value_get_boxed (va->values);
@@ -1019,9 +1107,36 @@ static void get_all_requests_cb (TpProxy *proxy, GHashTable *properties,
             }
         }
 
-        mcd_connection_found_channel (connection, object_path, channel_props);
+        if (g_hash_table_contains (known, object_path))
+            continue;
+
+        /* We don't have a McdChannel for this channel, which most likely
+         * means that it was already present on the connection before MC
+         * started. Let's try to recover it */
+        channel = mcd_connection_recover_channel (connection, object_path,
+                                                  channel_props);
+
+        if (channel != NULL)
+        {
+            g_ptr_array_add (recovered, g_object_ref (channel));
+            g_hash_table_add (known, g_strdup (object_path));
+        }
+    }
+
+    if (recovered->len > 0)
+        DEBUG ("recovering %u channels on %s", recovered->len,
+               tp_proxy_get_object_path (proxy));
+
+    for (i = 0; i < recovered->len; i++)
+    {
+        _mcd_dispatcher_recover_channel (priv->dispatcher,
+            g_ptr_array_index (recovered, i),
+            mcd_account_get_object_path (priv->account));
     }
 
+    g_ptr_array_unref (recovered);
+    g_hash_table_unref (known);
+
     priv->dispatched_initial_channels = TRUE;
 }
 
@@ -1045,6 +1160,20 @@ mcd_connection_setup_requests (McdConnection *connection)
         get_all_requests_cb, priv, NULL, (GObject *)connection);
 }
 
+/* Start watching for channels as soon as we know we can, rather than
+ * waiting for the other preparations before Connect to finish. */
+static void
+mcd_connection_add_to_dispatcher (McdConnection *self)
+{
+    if (self->priv->added_to_dispatcher ||
+        !tp_proxy_has_interface_by_id (self->priv->tp_conn,
+            TP_IFACE_QUARK_CONNECTION_INTERFACE_REQUESTS))
+        return;
+
+    self->priv->added_to_dispatcher = TRUE;
+    _mcd_dispatcher_add_connection (self->priv->dispatcher, self);
+}
+
 static void
 on_connection_ready (GObject *source_object, GAsyncResult *result,
                      gpointer user_data)
@@ -1111,11 +1240,11 @@ on_connection_ready (GObject *source_object, GAsyncResult *result,
     if (priv->has_power_saving_if)
       _mcd_connection_setup_power_saving (connection);
 
-    if (!priv->dispatching_started)
-        _mcd_dispatcher_add_connection (priv->dispatcher, connection);
+    mcd_connection_add_to_dispatcher (connection);
 
     request_unrequested_channels (connection);
 
+    mcd_connection_end_phase (connection, MCD_CONNECTION_PHASE_READY);
     g_signal_emit (connection, signals[READY], 0);
 
 finally:
@@ -1168,13 +1297,11 @@ mcd_connection_done_task_before_connect (McdConnection *self)
         if (self->priv->tp_conn == NULL)
         {
             DEBUG ("TpConnection went away, not doing anything");
+            return;
         }
 
-        if (tp_proxy_has_interface_by_id (self->priv->tp_conn,
-                TP_IFACE_QUARK_CONNECTION_INTERFACE_REQUESTS))
-        {
-            _mcd_dispatcher_add_connection (self->priv->dispatcher, self);
-        }
+        mcd_connection_add_to_dispatcher (self);
+        mcd_connection_end_phase (self, MCD_CONNECTION_PHASE_PREPARE);
 
         DEBUG ("%s: Calling Connect()",
                tp_proxy_get_object_path (self->priv->tp_conn));
@@ -1290,8 +1417,6 @@ mcd_connection_early_get_interfaces_cb (TpProxy *proxy,
                 if (client_caps != NULL)
                 {
                     _mcd_connection_update_client_caps (self, client_caps);
-                    g_ptr_array_foreach (client_caps,
-                                         (GFunc) g_value_array_free, NULL);
                     g_ptr_array_unref (client_caps);
                 }
                 /* else the McdDispatcher hasn't sorted itself out yet, so
@@ -1303,6 +1428,7 @@ mcd_connection_early_get_interfaces_cb (TpProxy *proxy,
               /* If we have the Requests iface, we could start dispatching
                * before the connection is in CONNECTED state */
               tp_proxy_add_interface_by_id ((TpProxy *) tp_conn, q);
+              mcd_connection_add_to_dispatcher (self);
             }
         }
     }
@@ -1427,6 +1553,7 @@ request_connection_cb (TpConnectionManager *proxy, const gchar *bus_name,
     }
 
     DEBUG ("created %s", obj_path);
+    mcd_connection_end_phase (connection, MCD_CONNECTION_PHASE_REQUEST);
 
     _mcd_connection_set_tp_connection (connection, bus_name, obj_path, &error);
     if (G_UNLIKELY (error))
@@ -1465,6 +1592,7 @@ _mcd_connection_connect_with_params (McdConnection *connection,
     g_signal_emit (connection, signals[CONNECTION_STATUS_CHANGED], 0,
                    TP_CONNECTION_STATUS_CONNECTING,
                    TP_CONNECTION_STATUS_REASON_REQUESTED, NULL, NULL, NULL);
+    mcd_connection_start_phases (connection);
 
     /* If the McdConnection gets aborted (which results in it being freed!),
      * we need to kill off the Connection. So, we can't use connection as the
@@ -1544,7 +1672,7 @@ _mcd_connection_release_tp_connection (McdConnection *connection,
            the probation timer to go off: there's nothing for it to check  */
         if (priv->probation_timer > 0)
         {
-            g_source_remove (priv->probation_timer);
+            _mcd_timer_wheel_remove (priv->probation_timer);
             priv->probation_timer = 0;
         }
 
@@ -1555,6 +1683,7 @@ _mcd_connection_release_tp_connection (McdConnection *connection,
         g_hash_table_remove_all (priv->recognized_presences);
 
   priv->dispatching_started = FALSE;
+  priv->added_to_dispatcher = FALSE;
 }
 
 static void
@@ -1607,13 +1736,13 @@ _mcd_connection_dispose (GObject * object)
 
     if (priv->probation_timer)
     {
-        g_source_remove (priv->probation_timer);
+        _mcd_timer_wheel_remove (priv->probation_timer);
         priv->probation_timer = 0;
     }
 
     if (priv->reconnect_timer)
     {
-        g_source_remove (priv->reconnect_timer);
+        _mcd_timer_wheel_remove (priv->reconnect_timer);
         priv->reconnect_timer = 0;
     }
 
@@ -2094,7 +2223,7 @@ _mcd_connection_connect (McdConnection *connection, GHashTable *params)
 
     if (priv->reconnect_timer)
     {
-	g_source_remove (priv->reconnect_timer);
+	_mcd_timer_wheel_remove (priv->reconnect_timer);
 	priv->reconnect_timer = 0;
     }
 
@@ -2172,20 +2301,24 @@ _mcd_connection_update_property (McdConnection *connection, const gchar *name,
     g_free (interface);
 }
 
-void
-_mcd_connection_set_tp_connection (McdConnection *connection,
-                                   const gchar *bus_name,
-                                   const gchar *obj_path, GError **error)
+/*
+ * _mcd_connection_attach_tp_connection:
+ *
+ * Start using the Telepathy connection at @obj_path, but don't introspect
+ * it yet: call _mcd_connection_prepare_tp_connection() for that.
+ *
+ * Returns: %TRUE if @connection is now using a new Telepathy connection
+ */
+gboolean
+_mcd_connection_attach_tp_connection (McdConnection *connection,
+                                      const gchar *bus_name,
+                                      const gchar *obj_path, GError **error)
 {
     McdConnectionPrivate *priv;
-    GQuark features[] = {
-      TP_CONNECTION_FEATURE_CONNECTED,
-      0
-    };
     GError *inner_error = NULL;
 
-    g_return_if_fail (MCD_IS_CONNECTION (connection));
-    g_return_if_fail (error != NULL);
+    g_return_val_if_fail (MCD_IS_CONNECTION (connection), FALSE);
+    g_return_val_if_fail (error != NULL, FALSE);
     priv = connection->priv;
 
     if (priv->tp_conn != NULL)
@@ -2196,7 +2329,7 @@ _mcd_connection_set_tp_connection (McdConnection *connection,
             /* not really meant to happen */
             g_warning ("%s: We already have %s", G_STRFUNC,
                        tp_proxy_get_object_path (priv->tp_conn));
-            return;
+            return FALSE;
         }
 
         DEBUG ("releasing old connection first");
@@ -2222,7 +2355,7 @@ _mcd_connection_set_tp_connection (McdConnection *connection,
 
         g_hash_table_unref (details);
         g_propagate_error (error, inner_error);
-        return;
+        return FALSE;
     }
     /* FIXME: need some way to feed the status into the Account, but we don't
      * actually know it yet */
@@ -2234,13 +2367,39 @@ _mcd_connection_set_tp_connection (McdConnection *connection,
     g_signal_connect (priv->tp_conn, "notify::status",
                       G_CALLBACK (on_connection_status_changed),
                       connection);
+    return TRUE;
+}
+
+void
+_mcd_connection_prepare_tp_connection (McdConnection *connection)
+{
+    GQuark features[] = {
+      TP_CONNECTION_FEATURE_CONNECTED,
+      0
+    };
+
+    g_return_if_fail (MCD_IS_CONNECTION (connection));
+    g_return_if_fail (connection->priv->tp_conn != NULL);
+
     /* HACK for cancelling the _call_when_ready() callback when our object gets
      * destroyed */
-    tp_proxy_prepare_async (priv->tp_conn, features,
+    tp_proxy_prepare_async (connection->priv->tp_conn, features,
                             on_connection_ready,
                             tp_weak_ref_new (connection, NULL, NULL));
 }
 
+void
+_mcd_connection_set_tp_connection (McdConnection *connection,
+                                   const gchar *bus_name,
+                                   const gchar *obj_path, GError **error)
+{
+    g_return_if_fail (error != NULL);
+
+    if (_mcd_connection_attach_tp_connection (connection, bus_name, obj_path,
+                                              error))
+        _mcd_connection_prepare_tp_connection (connection);
+}
+
 /**
  * mcd_connection_get_tp_connection:
  * @connection: the #McdConnection.
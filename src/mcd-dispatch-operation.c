@@ -39,6 +39,7 @@
 #include "channel-utils.h"
 #include "mcd-channel-priv.h"
 #include "mcd-dbusprop.h"
+#include "mcd-dispatch-stats.h"
 #include "mcd-master-priv.h"
 #include "mcd-misc.h"
 #include "plugin-dispatch-operation.h"
@@ -253,6 +254,16 @@ struct _McdDispatchOperationPrivate
     /* If non-NULL, we're in the middle of asking plugins whether we may call
      * HandleChannels, or doing so. This is a client lock. */
     McdClientProxy *trying_handler;
+    /* If non-zero, a timeout after which we stop waiting for trying_handler
+     * to reply to HandleChannels and move on to the next handler */
+    guint handler_deadline_id;
+    /* Incremented each time we try a handler, so that a reply to an
+     * earlier HandleChannels call can be told apart from the current one,
+     * even if both went to the same client */
+    guint handler_attempt;
+    /* TRUE if trying_handler was named by an Approver or by the request,
+     * rather than picked by us from possible_handlers */
+    gboolean trying_preferred_handler;
 
     /* If TRUE, we've tried all the BypassApproval handlers, which happens
      * before we run approvers. */
@@ -261,8 +272,22 @@ struct _McdDispatchOperationPrivate
     McdPluginDispatchOperation *plugin_api;
     gsize plugins_pending;
     gboolean did_post_observer_actions;
+
+    /* when each stage of dispatching was reached */
+    McdDispatchTimeline timeline;
+
+    /* TRUE if we have emitted "released" */
+    gboolean released;
+};
+
+enum
+{
+    S_RELEASED,
+    N_SIGNALS
 };
 
+static guint signals[N_SIGNALS] = { 0 };
+
 static void _mcd_dispatch_operation_check_finished (
     McdDispatchOperation *self);
 static void _mcd_dispatch_operation_finish (McdDispatchOperation *,
@@ -385,10 +410,26 @@ static void _mcd_dispatch_operation_close_as_undispatchable (
 static gboolean mcd_dispatch_operation_idle_run_approvers (gpointer p);
 static void mcd_dispatch_operation_set_channel_handled_by (
     McdDispatchOperation *self, McdChannel *channel, const gchar *unique_name,
-    const gchar *well_known_name);
+    const gchar *well_known_name, gboolean chosen_by_us);
 static gboolean _mcd_dispatch_operation_handlers_can_bypass_approval (
     McdDispatchOperation *self);
 
+/*
+ * Tell the dispatcher that we are no longer waiting for any client to
+ * reply, and won't call any more clients unless an approver or a failing
+ * handler makes us, so another dispatch operation can start.
+ */
+static void
+mcd_dispatch_operation_release (McdDispatchOperation *self)
+{
+    if (self->priv->released)
+        return;
+
+    DEBUG ("%s/%p", self->priv->unique_name, self);
+    self->priv->released = TRUE;
+    g_signal_emit (self, signals[S_RELEASED], 0);
+}
+
 static void
 _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
 {
@@ -407,6 +448,9 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
         return;
     }
 
+    _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                 MCD_DISPATCH_STAGE_PLUGIN_DELAY);
+
     /* Check whether plugins' requests to close channels later should be
      * honoured. We want to do this before running Approvers (if any). */
     if (self->priv->observers_pending == 0 &&
@@ -445,6 +489,9 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
         return;
     }
 
+    _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                 MCD_DISPATCH_STAGE_OBSERVERS);
+
     /* if we've called the first Approver, we may not continue until we've
      * called them all, and they all replied "I'm ready" */
     if (self->priv->ado_pending > 0)
@@ -461,6 +508,10 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
         return;
     }
 
+    if (self->priv->result != NULL || self->priv->observe_only ||
+        _mcd_dispatch_operation_is_internal (self))
+        mcd_dispatch_operation_release (self);
+
     /* if a handler has claimed or accepted the channel, we have nothing to
      * do */
     if (self->priv->result != NULL)
@@ -511,6 +562,7 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
 
         DEBUG ("%s", incapable.message);
         _mcd_dispatch_operation_close_as_undispatchable (self, &incapable);
+        mcd_dispatch_operation_release (self);
         return;
     }
 
@@ -530,10 +582,12 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
             McdChannel *channel = self->priv->channel;
 
             mcd_dispatch_operation_set_channel_handled_by (self, channel,
-                caller, NULL);
+                caller, NULL, FALSE);
         }
 
         DEBUG ("Replying to Claim call from %s", caller);
+        _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                     MCD_DISPATCH_STAGE_APPROVERS);
 
         tp_svc_channel_dispatch_operation_return_from_claim (
             approval->context);
@@ -557,6 +611,8 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
     {
         /* We set this to TRUE so that the handlers are called. */
         self->priv->invoked_approvers_if_needed = TRUE;
+        _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                     MCD_DISPATCH_STAGE_APPROVERS);
 
         if (approver_event_id > 0)
         {
@@ -579,11 +635,13 @@ _mcd_dispatch_operation_check_client_locks (McdDispatchOperation *self)
                 DEBUG ("ran out of handlers");
                 _mcd_dispatch_operation_close_as_undispatchable (self,
                                                                  &incapable);
+                mcd_dispatch_operation_release (self);
             }
         }
         else
         {
             DEBUG ("waiting for approval");
+            mcd_dispatch_operation_release (self);
         }
     }
     else if (!self->priv->tried_handlers_before_approval)
@@ -763,7 +821,8 @@ static void
 mcd_dispatch_operation_set_channel_handled_by (McdDispatchOperation *self,
                                                McdChannel *channel,
                                                const gchar *unique_name,
-                                               const gchar *well_known_name)
+                                               const gchar *well_known_name,
+                                               gboolean chosen_by_us)
 {
     TpChannel *tp_channel;
 
@@ -777,6 +836,22 @@ mcd_dispatch_operation_set_channel_handled_by (McdDispatchOperation *self,
     _mcd_handler_map_set_channel_handled (self->priv->handler_map,
         tp_channel, unique_name, well_known_name,
         _mcd_dispatch_operation_get_account_path (self));
+
+    /* remember which Handler took it, so that similar requests can be
+     * predicted to go there (and have it started early); a Handler that an
+     * Approver or requester insisted on says nothing about which one we
+     * should pick by ourselves */
+    if (chosen_by_us && well_known_name != NULL &&
+        self->priv->client_registry != NULL)
+    {
+        GVariant *properties = tp_channel_dup_immutable_properties (
+            tp_channel);
+
+        _mcd_client_registry_note_handled (self->priv->client_registry,
+            _mcd_dispatch_operation_get_account_path (self), properties,
+            well_known_name);
+        g_variant_unref (properties);
+    }
 }
 
 static void
@@ -817,6 +892,7 @@ _mcd_dispatch_operation_finish (McdDispatchOperation *operation,
     priv->result = g_error_new_valist (domain, code, format, ap);
     va_end (ap);
     DEBUG ("Result: %s", priv->result->message);
+    _mcd_dispatch_timeline_mark (&priv->timeline, MCD_DISPATCH_STAGE_TOTAL);
 
     for (approval = g_queue_pop_head (priv->approvals);
          approval != NULL;
@@ -1310,6 +1386,15 @@ mcd_dispatch_operation_dispose (GObject *object)
 {
     McdDispatchOperationPrivate *priv = MCD_DISPATCH_OPERATION_PRIV (object);
 
+    if (priv->handler_deadline_id != 0)
+    {
+        g_source_remove (priv->handler_deadline_id);
+        priv->handler_deadline_id = 0;
+    }
+
+    /* in case we never got as far as releasing our slot */
+    mcd_dispatch_operation_release (MCD_DISPATCH_OPERATION (object));
+
     tp_clear_object (&priv->plugin_api);
     tp_clear_object (&priv->successful_handler);
 
@@ -1388,6 +1473,16 @@ _mcd_dispatch_operation_class_init (McdDispatchOperationClass * klass)
                               FALSE,
                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
                               G_PARAM_STATIC_STRINGS));
+
+    /* Emitted at most once, when the operation has stopped waiting for
+     * Observers, Approvers and Handlers (it may still be waiting for the
+     * user to approve it). */
+    signals[S_RELEASED] = g_signal_new ("released",
+        G_OBJECT_CLASS_TYPE (klass),
+        G_SIGNAL_RUN_LAST,
+        0, NULL, NULL,
+        g_cclosure_marshal_VOID__VOID,
+        G_TYPE_NONE, 0);
 }
 
 static void
@@ -1400,6 +1495,7 @@ _mcd_dispatch_operation_init (McdDispatchOperation *operation)
                                         McdDispatchOperationPrivate);
     operation->priv = priv;
     operation->priv->approvals = g_queue_new ();
+    _mcd_dispatch_timeline_init (&operation->priv->timeline);
 
     /* initializes the interfaces */
     mcd_dbus_init_interfaces_instances (operation);
@@ -1855,23 +1951,143 @@ _mcd_dispatch_operation_dup_channel (McdDispatchOperation *self)
     return NULL;
 }
 
+/*
+ * A handler that we stopped waiting for has replied to HandleChannels
+ * after all. If it succeeded and nobody else has handled the channel yet,
+ * take it as the handler; otherwise just remember how it behaved.
+ */
+static void
+_mcd_dispatch_operation_late_handler_reply (McdDispatchOperation *self,
+                                            TpClient *client,
+                                            const GError *error,
+                                            gboolean chosen_by_us)
+{
+    McdClientProxy *proxy = MCD_CLIENT_PROXY (client);
+    const gchar *unique_name;
+
+    _mcd_client_proxy_note_reply (proxy, error);
+
+    if (error != NULL)
+    {
+        /* the failure was already counted when it missed its deadline */
+        DEBUG ("late error from %s: %s", tp_proxy_get_bus_name (client),
+               error->message);
+        return;
+    }
+
+    _mcd_client_proxy_note_success (proxy);
+
+    if (self->priv->result != NULL)
+    {
+        DEBUG ("%s handled the channel after its deadline, but dispatching "
+               "had already finished", tp_proxy_get_bus_name (client));
+        return;
+    }
+
+    unique_name = _mcd_client_proxy_get_unique_name (proxy);
+
+    if (self->priv->successful_handler != NULL ||
+        self->priv->channel == NULL ||
+        unique_name == NULL || unique_name[0] == '\0' ||
+        _mcd_handler_map_get_handler (self->priv->handler_map,
+            mcd_channel_get_object_path (self->priv->channel), NULL) != NULL)
+    {
+        DEBUG ("%s handled the channel after its deadline, but another "
+               "handler already took it", tp_proxy_get_bus_name (client));
+        return;
+    }
+
+    DEBUG ("%s handled the channel after its deadline; keeping it",
+           tp_proxy_get_bus_name (client));
+    mcd_dispatch_operation_set_channel_handled_by (self,
+        self->priv->channel, unique_name, tp_proxy_get_bus_name (client),
+        chosen_by_us);
+    _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                 MCD_DISPATCH_STAGE_HANDLER_RETURNED);
+    self->priv->successful_handler = g_object_ref (client);
+    _mcd_dispatch_operation_finish (self, TP_ERROR, TP_ERROR_NOT_YOURS,
+                                    "Channel successfully handled by %s",
+                                    tp_proxy_get_bus_name (client));
+}
+
+/* One HandleChannels call */
+typedef struct {
+    /* owned */
+    McdDispatchOperation *self;
+    /* the value of handler_attempt when we made the call */
+    guint attempt;
+    /* FALSE if the handler was named by an Approver or by the request */
+    gboolean chosen_by_us;
+} HandlerAttempt;
+
+static HandlerAttempt *
+handler_attempt_new (McdDispatchOperation *self)
+{
+    HandlerAttempt *ha = g_slice_new (HandlerAttempt);
+
+    ha->self = g_object_ref (self);
+    ha->attempt = self->priv->handler_attempt;
+    ha->chosen_by_us = !self->priv->trying_preferred_handler;
+    return ha;
+}
+
+static void
+handler_attempt_free (gpointer p)
+{
+    HandlerAttempt *ha = p;
+
+    g_object_unref (ha->self);
+    g_slice_free (HandlerAttempt, ha);
+}
+
 static void
 _mcd_dispatch_operation_handle_channels_cb (TpClient *client,
                                             const GError *error,
                                             gpointer user_data,
                                             GObject *weak G_GNUC_UNUSED)
 {
-    McdDispatchOperation *self = user_data;
+    HandlerAttempt *ha = user_data;
+    McdDispatchOperation *self = ha->self;
+
+    /* we gave up on this call when it missed its deadline */
+    if (self->priv->trying_handler == NULL ||
+        ha->attempt != self->priv->handler_attempt)
+    {
+        _mcd_dispatch_operation_late_handler_reply (self, client, error,
+            ha->chosen_by_us);
+        return;
+    }
+
+    if (self->priv->handler_deadline_id != 0)
+    {
+        g_source_remove (self->priv->handler_deadline_id);
+        self->priv->handler_deadline_id = 0;
+    }
+
+    _mcd_client_proxy_note_reply (MCD_CLIENT_PROXY (client), error);
 
     if (error)
     {
         DEBUG ("error: %s", error->message);
 
+        _mcd_client_proxy_note_failure (MCD_CLIENT_PROXY (client));
+
         _mcd_dispatch_operation_set_handler_failed (self,
             tp_proxy_get_bus_name (client), error);
     }
+    else if (self->priv->successful_handler != NULL)
+    {
+        _mcd_client_proxy_note_success (MCD_CLIENT_PROXY (client));
+
+        /* a handler we had given up on got there first */
+        DEBUG ("%s handled the channel, but %s already had",
+               tp_proxy_get_bus_name (client),
+               tp_proxy_get_bus_name (self->priv->successful_handler));
+    }
     else
     {
+        _mcd_client_proxy_note_success (MCD_CLIENT_PROXY (client));
+
         /* FIXME: can channel ever be NULL here? */
         if (self->priv->channel != NULL)
         {
@@ -1908,13 +2124,16 @@ _mcd_dispatch_operation_handle_channels_cb (TpClient *client,
             else
             {
                 mcd_dispatch_operation_set_channel_handled_by (self, channel,
-                    unique_name, tp_proxy_get_bus_name (client));
+                    unique_name, tp_proxy_get_bus_name (client),
+                    ha->chosen_by_us);
             }
         }
 
         /* emit Finished, if we haven't already; but first make a note of the
          * handler we used, so we can reply to all the HandleWith calls with
          * success or failure */
+        _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                     MCD_DISPATCH_STAGE_HANDLER_RETURNED);
         self->priv->successful_handler = g_object_ref (client);
         _mcd_dispatch_operation_finish (self, TP_ERROR, TP_ERROR_NOT_YOURS,
                                         "Channel successfully handled by %s",
@@ -1938,9 +2157,26 @@ observe_channels_cb (TpClient *proxy, const GError *error,
     else
         DEBUG ("success from %s", tp_proxy_get_object_path (proxy));
 
+    _mcd_client_proxy_note_reply (MCD_CLIENT_PROXY (proxy), error);
     _mcd_dispatch_operation_dec_observers_pending (self, MCD_CLIENT_PROXY (proxy));
 }
 
+static void
+observe_channels_unwaited_cb (TpClient *proxy,
+                              const GError *error,
+                              gpointer user_data G_GNUC_UNUSED,
+                              GObject *weak_object G_GNUC_UNUSED)
+{
+    if (error)
+        DEBUG ("Degraded observer %s returned error: %s",
+               tp_proxy_get_object_path (proxy), error->message);
+    else
+        DEBUG ("success from degraded observer %s",
+               tp_proxy_get_object_path (proxy));
+
+    _mcd_client_proxy_note_reply (MCD_CLIENT_PROXY (proxy), error);
+}
+
 /*
  * @paths_out: (out) (transfer container) (element-type utf8):
  *  Requests_Satisfied
@@ -1998,10 +2234,12 @@ _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
     GHashTable *observer_info;
     GHashTableIter iter;
     gpointer client_p;
+    gint deadline = _mcd_client_get_deadline (MCD_CLIENT_ROLE_OBSERVER);
 
     observer_info = tp_asv_new (NULL, NULL);
 
-    _mcd_client_registry_init_hash_iter (self->priv->client_registry, &iter);
+    _mcd_client_registry_init_role_iter (self->priv->client_registry,
+                                         MCD_CLIENT_ROLE_OBSERVER, &iter);
 
     while (g_hash_table_iter_next (&iter, NULL, &client_p))
     {
@@ -2011,10 +2249,6 @@ _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
         GPtrArray *channels_array, *satisfied_requests;
         GHashTable *request_properties;
 
-        if (!tp_proxy_has_interface_by_id (client,
-                                           TP_IFACE_QUARK_CLIENT_OBSERVER))
-            continue;
-
         if (self->priv->channel != NULL)
         {
             McdChannel *channel = MCD_CHANNEL (self->priv->channel);
@@ -2058,16 +2292,33 @@ _mcd_dispatch_operation_run_observers (McdDispatchOperation *self)
             dispatch_operation_path = _mcd_dispatch_operation_get_path (self);
         }
 
-        _mcd_dispatch_operation_inc_observers_pending (self, client);
-
-        DEBUG ("calling ObserveChannels on %s for CDO %p",
-               tp_proxy_get_bus_name (client), self);
-        tp_cli_client_observer_call_observe_channels (
-            (TpClient *) client, -1,
-            account_path, connection_path, channels_array,
-            dispatch_operation_path, satisfied_requests, observer_info,
-            observe_channels_cb,
-            g_object_ref (self), g_object_unref, NULL);
+        if (_mcd_client_proxy_is_degraded (client))
+        {
+            /* This observer didn't answer in time last time we called it,
+             * so don't hold up approvers and handlers for it again: it
+             * still gets told about the channel, but we don't wait. */
+            DEBUG ("calling ObserveChannels on degraded observer %s for "
+                   "CDO %p, not waiting for it",
+                   tp_proxy_get_bus_name (client), self);
+            tp_cli_client_observer_call_observe_channels (
+                (TpClient *) client, deadline,
+                account_path, connection_path, channels_array,
+                dispatch_operation_path, satisfied_requests, observer_info,
+                observe_channels_unwaited_cb, NULL, NULL, NULL);
+        }
+        else
+        {
+            _mcd_dispatch_operation_inc_observers_pending (self, client);
+
+            DEBUG ("calling ObserveChannels on %s for CDO %p",
+                   tp_proxy_get_bus_name (client), self);
+            tp_cli_client_observer_call_observe_channels (
+                (TpClient *) client, deadline,
+                account_path, connection_path, channels_array,
+                dispatch_operation_path, satisfied_requests, observer_info,
+                observe_channels_cb,
+                g_object_ref (self), g_object_unref, NULL);
+        }
 
         g_ptr_array_unref (satisfied_requests);
 
@@ -2085,15 +2336,20 @@ add_dispatch_operation_cb (TpClient *proxy,
 {
     McdDispatchOperation *self = user_data;
 
+    _mcd_client_proxy_note_reply (MCD_CLIENT_PROXY (proxy), error);
+
     if (error)
     {
         DEBUG ("AddDispatchOperation %s (%p) on approver %s failed: "
                "%s",
                _mcd_dispatch_operation_get_path (self), self,
                tp_proxy_get_object_path (proxy), error->message);
+        _mcd_client_proxy_note_failure (MCD_CLIENT_PROXY (proxy));
     }
     else
     {
+        _mcd_client_proxy_note_success (MCD_CLIENT_PROXY (proxy));
+
         DEBUG ("Approver %s accepted AddDispatchOperation %s (%p)",
                tp_proxy_get_object_path (proxy),
                _mcd_dispatch_operation_get_path (self), self);
@@ -2116,46 +2372,61 @@ _mcd_dispatch_operation_run_approvers (McdDispatchOperation *self)
 {
     GHashTableIter iter;
     gpointer client_p;
+    GPtrArray *matched;
+    gboolean any_healthy = FALSE;
+    guint i;
 
     /* we temporarily increment this count and decrement it at the end of the
      * function, to make sure it won't become 0 while we are still invoking
      * approvers */
     _mcd_dispatch_operation_inc_ado_pending (self);
 
-    _mcd_client_registry_init_hash_iter (self->priv->client_registry, &iter);
-    while (g_hash_table_iter_next (&iter, NULL, &client_p))
+    matched = g_ptr_array_new ();
+
+    /* FIXME: it shouldn't be possible to get here without a channel */
+    if (self->priv->channel != NULL)
     {
-        McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
-        GPtrArray *channel_details;
-        const gchar *dispatch_operation;
-        GHashTable *properties;
-        gboolean matched = FALSE;
+        GVariant *channel_properties;
 
-        if (!tp_proxy_has_interface_by_id (client,
-                                           TP_IFACE_QUARK_CLIENT_APPROVER))
-            continue;
+        channel_properties = mcd_channel_dup_immutable_properties (
+            self->priv->channel);
+        g_assert (channel_properties != NULL);
 
-        if (self->priv->channel != NULL)
+        _mcd_client_registry_init_role_iter (self->priv->client_registry,
+                                             MCD_CLIENT_ROLE_APPROVER, &iter);
+        while (g_hash_table_iter_next (&iter, NULL, &client_p))
         {
-            McdChannel *channel = MCD_CHANNEL (self->priv->channel);
-            GVariant *channel_properties;
-
-            channel_properties = mcd_channel_dup_immutable_properties (channel);
-            g_assert (channel_properties != NULL);
+            McdClientProxy *client = MCD_CLIENT_PROXY (client_p);
 
             if (_mcd_client_match_filters (channel_properties,
                 _mcd_client_proxy_get_approver_filters (client),
                 FALSE))
             {
-                matched = TRUE;
-            }
+                g_ptr_array_add (matched, client);
 
-            g_variant_unref (channel_properties);
+                if (!_mcd_client_proxy_is_cooling_down (client))
+                    any_healthy = TRUE;
+            }
         }
 
-        /* in particular, after this point, self->priv->channel can't
-         * be NULL */
-        if (!matched) continue;
+        g_variant_unref (channel_properties);
+    }
+
+    for (i = 0; i < matched->len; i++)
+    {
+        McdClientProxy *client = g_ptr_array_index (matched, i);
+        GPtrArray *channel_details;
+        const gchar *dispatch_operation;
+        GHashTable *properties;
+
+        /* Don't bother an approver that has been failing, unless it's the
+         * best we've got */
+        if (any_healthy && _mcd_client_proxy_is_cooling_down (client))
+        {
+            DEBUG ("Skipping approver %s: it has been failing recently",
+                   tp_proxy_get_bus_name (client));
+            continue;
+        }
 
         dispatch_operation = _mcd_dispatch_operation_get_path (self);
         properties = _mcd_dispatch_operation_get_properties (self);
@@ -2168,7 +2439,8 @@ _mcd_dispatch_operation_run_approvers (McdDispatchOperation *self)
         _mcd_dispatch_operation_inc_ado_pending (self);
 
         tp_cli_client_approver_call_add_dispatch_operation (
-            (TpClient *) client, -1,
+            (TpClient *) client,
+            _mcd_client_get_deadline (MCD_CLIENT_ROLE_APPROVER),
             channel_details, dispatch_operation, properties,
             add_dispatch_operation_cb,
             g_object_ref (self), g_object_unref, NULL);
@@ -2176,6 +2448,8 @@ _mcd_dispatch_operation_run_approvers (McdDispatchOperation *self)
         g_boxed_free (TP_ARRAY_TYPE_CHANNEL_DETAILS_LIST, channel_details);
     }
 
+    g_ptr_array_unref (matched);
+
     /* This matches the approvers count set to 1 at the beginning of the
      * function */
     _mcd_dispatch_operation_dec_ado_pending (self);
@@ -2205,15 +2479,25 @@ _mcd_dispatch_operation_run_clients (McdDispatchOperation *self)
 {
     g_object_ref (self);
     DEBUG ("%s %p", self->priv->unique_name, self);
+    _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                 MCD_DISPATCH_STAGE_CHANNEL_READY);
 
     if (self->priv->channel != NULL)
     {
-        const GList *mini_plugins;
+        const GList *mini_plugins = mcp_list_objects ();
+        McdRequest *request = _mcd_channel_get_request (self->priv->channel);
 
         DEBUG ("Running observers");
         _mcd_dispatch_operation_run_observers (self);
 
-        for (mini_plugins = mcp_list_objects ();
+        /* emergency calls must not be held up by policy plugins */
+        if (request != NULL && _mcd_request_is_urgent (request))
+        {
+            DEBUG ("Not asking policy plugins about an urgent request");
+            mini_plugins = NULL;
+        }
+
+        for (;
              mini_plugins != NULL;
              mini_plugins = mini_plugins->next)
         {
@@ -2235,6 +2519,73 @@ _mcd_dispatch_operation_run_clients (McdDispatchOperation *self)
     g_object_unref (self);
 }
 
+static gboolean
+_mcd_dispatch_operation_has_untried_handler (McdDispatchOperation *self)
+{
+    gboolean is_approved = _mcd_dispatch_operation_is_approved (self);
+    gchar **iter;
+
+    for (iter = self->priv->possible_handlers;
+         iter != NULL && *iter != NULL;
+         iter++)
+    {
+        McdClientProxy *handler = _mcd_client_registry_lookup (
+            self->priv->client_registry, *iter);
+
+        if (handler != NULL &&
+            handler != self->priv->trying_handler &&
+            !_mcd_dispatch_operation_get_handler_failed (self, *iter) &&
+            (is_approved || _mcd_client_proxy_get_bypass_approval (handler)))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+mcd_dispatch_operation_handler_deadline_cb (gpointer user_data)
+{
+    McdDispatchOperation *self = user_data;
+    McdClientProxy *handler = self->priv->trying_handler;
+    GError *error;
+
+    self->priv->handler_deadline_id = 0;
+
+    g_return_val_if_fail (handler != NULL, FALSE);
+
+    /* if there is nobody else to try, we might as well keep waiting */
+    if (!_mcd_dispatch_operation_has_untried_handler (self))
+    {
+        DEBUG ("%s is slow to handle %s, but there is no other handler",
+               tp_proxy_get_bus_name (handler), self->priv->unique_name);
+        return FALSE;
+    }
+
+    DEBUG ("%s missed its HandleChannels deadline for %s, trying the next "
+           "handler", tp_proxy_get_bus_name (handler),
+           self->priv->unique_name);
+
+    g_object_ref (self);
+    _mcd_client_proxy_note_missed_deadline (handler);
+    _mcd_client_proxy_note_failure (handler);
+
+    error = g_error_new (TP_ERROR, TP_ERROR_NOT_AVAILABLE,
+                         "Handler %s did not reply to HandleChannels in time",
+                         tp_proxy_get_bus_name (handler));
+
+    /* The call stays outstanding: if it does eventually succeed,
+     * _mcd_dispatch_operation_late_handler_reply() will notice */
+    self->priv->trying_handler = NULL;
+    _mcd_dispatch_operation_set_handler_failed (self,
+        tp_proxy_get_bus_name (handler), error);
+    g_object_unref (handler);
+    g_error_free (error);
+
+    _mcd_dispatch_operation_check_client_locks (self);
+    g_object_unref (self);
+    return FALSE;
+}
+
 /*
  * mcd_dispatch_operation_handle_channels:
  * @self: the dispatch operation
@@ -2248,6 +2599,9 @@ mcd_dispatch_operation_handle_channels (McdDispatchOperation *self)
     GList *channels = NULL;
     GHashTable *handler_info;
     GHashTable *request_properties;
+    HandlerAttempt *ha;
+    const gchar *unique_name;
+    gint deadline;
 
     g_assert (self->priv->trying_handler != NULL);
 
@@ -2260,9 +2614,11 @@ mcd_dispatch_operation_handle_channels (McdDispatchOperation *self)
          * handler_unsuitable */
         self->priv->handler_unsuitable = NULL;
 
+        ha = handler_attempt_new (self);
         _mcd_dispatch_operation_handle_channels_cb (
             (TpClient *) self->priv->trying_handler,
-            tmp, self, NULL);
+            tmp, ha, NULL);
+        handler_attempt_free (ha);
         g_error_free (tmp);
 
         return;
@@ -2286,10 +2642,26 @@ mcd_dispatch_operation_handle_channels (McdDispatchOperation *self)
         TP_HASH_TYPE_OBJECT_IMMUTABLE_PROPERTIES_MAP, request_properties);
     request_properties = NULL;
 
+    /* The deadline only decides when we stop waiting for the handler and
+     * try the next one: the call itself keeps the default D-Bus timeout,
+     * so the handler can still take the channel until then. A handler
+     * that is not running yet is not held to it, because starting it
+     * might take most of the deadline. */
+    deadline = _mcd_client_get_deadline (MCD_CLIENT_ROLE_HANDLER);
+    unique_name = _mcd_client_proxy_get_unique_name (
+        self->priv->trying_handler);
+
+    if (deadline > 0 && unique_name != NULL && unique_name[0] != '\0')
+    {
+        g_assert (self->priv->handler_deadline_id == 0);
+        self->priv->handler_deadline_id = g_timeout_add (deadline,
+            mcd_dispatch_operation_handler_deadline_cb, self);
+    }
+
     _mcd_client_proxy_handle_channels (self->priv->trying_handler,
         -1, channels, self->priv->handle_with_time,
         handler_info, _mcd_dispatch_operation_handle_channels_cb,
-        g_object_ref (self), g_object_unref, NULL);
+        handler_attempt_new (self), handler_attempt_free, NULL);
 
     g_hash_table_unref (handler_info);
     g_list_free (channels);
@@ -2332,6 +2704,9 @@ mcd_dispatch_operation_try_handler (McdDispatchOperation *self,
 
     g_assert (self->priv->trying_handler == NULL);
     self->priv->trying_handler = g_object_ref (handler);
+    self->priv->handler_attempt++;
+    _mcd_dispatch_timeline_mark (&self->priv->timeline,
+                                 MCD_DISPATCH_STAGE_HANDLER_CHOSEN);
 
     self->priv->handler_suitable_pending = 0;
 
@@ -2393,6 +2768,7 @@ _mcd_dispatch_operation_try_next_handler (McdDispatchOperation *self)
         if (handler != NULL &&
             (approval->type == APPROVAL_TYPE_HANDLE_WITH || !failed))
         {
+            self->priv->trying_preferred_handler = TRUE;
             mcd_dispatch_operation_try_handler (self, handler);
             return TRUE;
         }
@@ -2431,6 +2807,7 @@ _mcd_dispatch_operation_try_next_handler (McdDispatchOperation *self)
         if (handler != NULL && !failed &&
             (is_approved || _mcd_client_proxy_get_bypass_approval (handler)))
         {
+            self->priv->trying_preferred_handler = FALSE;
             mcd_dispatch_operation_try_handler (self, handler);
             return TRUE;
         }
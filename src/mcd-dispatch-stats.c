@@ -0,0 +1,258 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Per-stage latency histograms for channel dispatching.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include "mcd-dispatch-stats.h"
+
+#include <string.h>
+
+#include <dbus/dbus-glib.h>
+
+#include "mcd-debug.h"
+
+/* Bucket i counts samples below (1 << i) ms; the last bucket counts
+ * everything slower than that. */
+#define N_BOUNDED_BUCKETS 16
+#define N_BUCKETS (N_BOUNDED_BUCKETS + 1)
+
+typedef struct {
+    guint64 count;
+    guint64 total_us;
+    guint64 max_us;
+    guint32 buckets[N_BUCKETS];
+} Histogram;
+
+static Histogram histograms[MCD_DISPATCH_N_STAGES];
+
+static const gchar * const stage_names[MCD_DISPATCH_N_STAGES] = {
+    "request-policy",
+    "request-channel",
+    "channel-ready",
+    "plugin-delay",
+    "observers",
+    "approvers",
+    "handler-chosen",
+    "handler-returned",
+    "total"
+};
+
+const gchar *
+_mcd_dispatch_stage_get_name (McdDispatchStage stage)
+{
+    g_return_val_if_fail (stage < MCD_DISPATCH_N_STAGES, NULL);
+
+    return stage_names[stage];
+}
+
+void
+_mcd_dispatch_stats_record (McdDispatchStage stage,
+                            gint64 elapsed_us)
+{
+    Histogram *h;
+    guint i;
+
+    g_return_if_fail (stage < MCD_DISPATCH_N_STAGES);
+
+    if (elapsed_us < 0)
+        elapsed_us = 0;
+
+    h = &histograms[stage];
+    h->count++;
+    h->total_us += elapsed_us;
+    h->max_us = MAX (h->max_us, (guint64) elapsed_us);
+
+    for (i = 0; i < N_BOUNDED_BUCKETS; i++)
+    {
+        if (elapsed_us < ((gint64) 1000 << i))
+            break;
+    }
+
+    h->buckets[i]++;
+}
+
+void
+_mcd_dispatch_stats_reset (void)
+{
+    memset (histograms, 0, sizeof (histograms));
+}
+
+/*
+ * _mcd_dispatch_timeline_init:
+ * @tl: a timeline embedded in a request or dispatch operation
+ *
+ * Start timing a request or dispatch operation from now.
+ */
+void
+_mcd_dispatch_timeline_init (McdDispatchTimeline *tl)
+{
+    memset (tl, 0, sizeof (*tl));
+    tl->start = tl->last = g_get_monotonic_time ();
+}
+
+/*
+ * _mcd_dispatch_timeline_mark:
+ * @tl: a timeline
+ * @stage: the stage that has just been completed
+ *
+ * Record that @stage has been completed, and add the time it took to the
+ * histogram for @stage. Only the first completion of each stage counts.
+ */
+void
+_mcd_dispatch_timeline_mark (McdDispatchTimeline *tl,
+                             McdDispatchStage stage)
+{
+    gint64 now;
+
+    g_return_if_fail (stage < MCD_DISPATCH_N_STAGES);
+
+    if (tl->stamps[stage] != 0)
+        return;
+
+    now = g_get_monotonic_time ();
+    tl->stamps[stage] = now;
+
+    if (stage == MCD_DISPATCH_STAGE_TOTAL)
+    {
+        _mcd_dispatch_stats_record (stage, now - tl->start);
+    }
+    else
+    {
+        _mcd_dispatch_stats_record (stage, now - tl->last);
+        tl->last = now;
+    }
+}
+
+/* A GObject so that dbus-glib can export the histograms; all the state is
+ * in the static variables above */
+typedef GObject McdDispatchStats;
+typedef GObjectClass McdDispatchStatsClass;
+
+G_GNUC_INTERNAL GType mcd_dispatch_stats_get_type (void);
+
+G_DEFINE_TYPE (McdDispatchStats, mcd_dispatch_stats, G_TYPE_OBJECT)
+
+static McdDispatchStats *exported = NULL;
+
+/* GetHistograms () -> (at: bucket upper bounds in microseconds,
+ *                      a(stttau): stage name, number of samples, total
+ *                       microseconds, slowest sample in microseconds,
+ *                       number of samples in each bucket) */
+static gboolean
+mcd_dispatch_stats_get_histograms (McdDispatchStats *self,
+                                   GArray **bucket_bounds,
+                                   GPtrArray **stages,
+                                   GError **error)
+{
+    guint i;
+
+    *bucket_bounds = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+                                        N_BOUNDED_BUCKETS);
+
+    for (i = 0; i < N_BOUNDED_BUCKETS; i++)
+    {
+        guint64 bound = (guint64) 1000 << i;
+
+        g_array_append_val (*bucket_bounds, bound);
+    }
+
+    /* dbus-glib frees the elements along with the array */
+    *stages = g_ptr_array_sized_new (MCD_DISPATCH_N_STAGES);
+
+    for (i = 0; i < MCD_DISPATCH_N_STAGES; i++)
+    {
+        const Histogram *h = &histograms[i];
+        GArray *buckets = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+                                             N_BUCKETS);
+
+        g_array_append_vals (buckets, h->buckets, N_BUCKETS);
+
+        g_ptr_array_add (*stages, tp_value_array_build (5,
+            G_TYPE_STRING, stage_names[i],
+            G_TYPE_UINT64, h->count,
+            G_TYPE_UINT64, h->total_us,
+            G_TYPE_UINT64, h->max_us,
+            DBUS_TYPE_G_UINT_ARRAY, buckets,
+            G_TYPE_INVALID));
+
+        g_array_unref (buckets);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+mcd_dispatch_stats_reset (McdDispatchStats *self,
+                          GError **error)
+{
+    DEBUG ("resetting dispatch latency histograms");
+    _mcd_dispatch_stats_reset ();
+    return TRUE;
+}
+
+#include "mcd-dispatch-stats-glue.h"
+
+static void
+mcd_dispatch_stats_init (McdDispatchStats *self)
+{
+}
+
+static void
+mcd_dispatch_stats_class_init (McdDispatchStatsClass *cls)
+{
+    dbus_g_object_type_install_info (mcd_dispatch_stats_get_type (),
+        &dbus_glib_mcd_dispatch_stats_object_info);
+}
+
+/*
+ * _mcd_dispatch_stats_export:
+ * @dbus_daemon: the session bus
+ *
+ * Make the histograms available at MCD_DISPATCH_STATS_OBJECT_PATH, on the
+ * same connection as the ChannelDispatcher.
+ */
+void
+_mcd_dispatch_stats_export (TpDBusDaemon *dbus_daemon)
+{
+    g_return_if_fail (TP_IS_DBUS_DAEMON (dbus_daemon));
+
+    if (exported != NULL)
+        return;
+
+    exported = g_object_new (mcd_dispatch_stats_get_type (), NULL);
+    tp_dbus_daemon_register_object (dbus_daemon,
+                                    MCD_DISPATCH_STATS_OBJECT_PATH, exported);
+}
+
+void
+_mcd_dispatch_stats_unexport (TpDBusDaemon *dbus_daemon)
+{
+    g_return_if_fail (TP_IS_DBUS_DAEMON (dbus_daemon));
+
+    if (exported == NULL)
+        return;
+
+    tp_dbus_daemon_unregister_object (dbus_daemon, exported);
+    g_clear_object (&exported);
+}
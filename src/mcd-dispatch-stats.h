@@ -0,0 +1,83 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Per-stage latency histograms for channel dispatching.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef MCD_DISPATCH_STATS_H_
+#define MCD_DISPATCH_STATS_H_
+
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+#define MCD_DISPATCH_STATS_OBJECT_PATH \
+    "/org/freedesktop/Telepathy/MissionControl5/DispatchStats"
+#define MCD_DISPATCH_STATS_IFACE \
+    "org.freedesktop.Telepathy.MissionControl5.Debug.DispatchStats"
+
+/* Each stage is timed from the end of the previous stage that the same
+ * request or dispatch operation went through, except for
+ * MCD_DISPATCH_STAGE_TOTAL, which covers the whole dispatch operation. */
+typedef enum {
+    /* Proceed() -> request policy plugins stopped delaying */
+    MCD_DISPATCH_STAGE_REQUEST_POLICY = 0,
+    /* request sent to the connection -> request succeeded */
+    MCD_DISPATCH_STAGE_REQUEST_CHANNEL,
+    /* channel announced by the connection -> observers about to run */
+    MCD_DISPATCH_STAGE_CHANNEL_READY,
+    /* dispatch operation policy plugins stopped delaying */
+    MCD_DISPATCH_STAGE_PLUGIN_DELAY,
+    /* all observers replied to ObserveChannels */
+    MCD_DISPATCH_STAGE_OBSERVERS,
+    /* an approver called HandleWith or Claim */
+    MCD_DISPATCH_STAGE_APPROVERS,
+    /* first handler selected */
+    MCD_DISPATCH_STAGE_HANDLER_CHOSEN,
+    /* a handler returned from HandleChannels successfully */
+    MCD_DISPATCH_STAGE_HANDLER_RETURNED,
+    /* channel announced -> dispatch operation finished */
+    MCD_DISPATCH_STAGE_TOTAL,
+    MCD_DISPATCH_N_STAGES
+} McdDispatchStage;
+
+typedef struct {
+    gint64 start;
+    gint64 last;
+    gint64 stamps[MCD_DISPATCH_N_STAGES];
+} McdDispatchTimeline;
+
+G_GNUC_INTERNAL void _mcd_dispatch_timeline_init (McdDispatchTimeline *tl);
+G_GNUC_INTERNAL void _mcd_dispatch_timeline_mark (McdDispatchTimeline *tl,
+    McdDispatchStage stage);
+
+G_GNUC_INTERNAL const gchar *_mcd_dispatch_stage_get_name (
+    McdDispatchStage stage);
+G_GNUC_INTERNAL void _mcd_dispatch_stats_record (McdDispatchStage stage,
+    gint64 elapsed_us);
+G_GNUC_INTERNAL void _mcd_dispatch_stats_reset (void);
+
+G_GNUC_INTERNAL void _mcd_dispatch_stats_export (TpDBusDaemon *dbus_daemon);
+G_GNUC_INTERNAL void _mcd_dispatch_stats_unexport (TpDBusDaemon *dbus_daemon);
+
+G_END_DECLS
+
+#endif
@@ -55,6 +55,7 @@
 #include "mcd-channel-priv.h"
 #include "mcd-dispatcher-priv.h"
 #include "mcd-dispatch-operation-priv.h"
+#include "mcd-dispatch-stats.h"
 #include "mcd-handler-map-priv.h"
 #include "mcd-misc.h"
 #include "plugin-loader.h"
@@ -104,6 +105,26 @@ typedef struct
     gboolean ensure;
 } McdChannelRequestACL;
 
+/* Dispatch operations waiting to start are served from the highest
+ * priority lane first, but lanes other than the emergency lane are
+ * weighted rather than strict, so background work is never starved. */
+typedef enum {
+    /* calls to emergency services: never wait */
+    MCD_DISPATCH_LANE_EMERGENCY = 0,
+    /* channels requested as a result of a user action */
+    MCD_DISPATCH_LANE_USER_ACTION,
+    /* incoming channels */
+    MCD_DISPATCH_LANE_INCOMING,
+    /* recovered channels, and requests with no user action */
+    MCD_DISPATCH_LANE_BACKGROUND,
+    MCD_DISPATCH_N_LANES
+} McdDispatchLane;
+
+static const guint lane_weights[MCD_DISPATCH_N_LANES] = { 0, 8, 4, 1 };
+
+static const gchar * const lane_names[MCD_DISPATCH_N_LANES] = {
+    "emergency", "user-action", "incoming", "background" };
+
 struct _McdDispatcherPrivate
 {
     /* Dispatching contexts */
@@ -131,6 +152,26 @@ struct _McdDispatcherPrivate
      * property. */
     gboolean operation_list_active;
 
+    /* Number of dispatch operations that have been started but not yet
+     * released, and operations waiting for one of them to be released
+     * (owned), oldest first, in one queue per lane. */
+    guint n_running_operations;
+    GQueue *queued_operations[MCD_DISPATCH_N_LANES];
+    /* how many more operations each lane may start before the lanes below
+     * it get a turn */
+    guint lane_credits[MCD_DISPATCH_N_LANES];
+    gboolean starting_operations;
+
+    /* Well-known names of Handlers whose capabilities have changed since
+     * they were last sent to connections, and the source that will send
+     * them; owned gchar * -> the same */
+    GHashTable *changed_caps;
+    guint push_caps_id;
+    /* The capabilities each Handler was last known to have when they were
+     * sent to connections, so we can leave out those that haven't
+     * really changed; owned gchar * -> owned GVariant */
+    GHashTable *pushed_caps;
+
     gboolean is_disposed;
 };
 
@@ -154,6 +195,42 @@ enum
 static void on_operation_finished (McdDispatchOperation *operation,
                                    McdDispatcher *self);
 
+/* Default number of dispatch operations which may be running observers,
+ * approvers and handlers at the same time */
+#define DEFAULT_MAX_RUNNING_OPERATIONS 16
+
+/*
+ * Returns: the maximum number of dispatch operations that may be running
+ *  at the same time, or 0 for no limit
+ */
+static guint
+mcd_dispatcher_get_max_running_operations (void)
+{
+    static gint max = -1;
+
+    if (G_UNLIKELY (max < 0))
+    {
+        const gchar *value = g_getenv ("MC_DISPATCH_CONCURRENCY");
+        gchar *end;
+        gint64 parsed;
+
+        max = DEFAULT_MAX_RUNNING_OPERATIONS;
+
+        if (value != NULL && *value != '\0')
+        {
+            parsed = g_ascii_strtoll (value, &end, 10);
+
+            if (*end != '\0' || parsed < 0 || parsed > G_MAXINT)
+                WARNING ("Ignoring invalid MC_DISPATCH_CONCURRENCY=%s",
+                         value);
+            else
+                max = parsed;
+        }
+    }
+
+    return max;
+}
+
 static void
 on_master_abort (McdMaster *master, McdDispatcherPrivate *priv)
 {
@@ -170,6 +247,7 @@ mcd_dispatcher_dup_internal_handlers (void)
 
 static GStrv
 mcd_dispatcher_dup_possible_handlers (McdDispatcher *self,
+                                      McdAccount *account,
                                       McdRequest *request,
                                       TpChannel *channel,
                                       const gchar *must_have_unique_name)
@@ -186,7 +264,8 @@ mcd_dispatcher_dup_possible_handlers (McdDispatcher *self,
 
     handlers = _mcd_client_registry_list_possible_handlers (
         self->priv->clients,
-        request != NULL ? _mcd_request_get_preferred_handler (request) : NULL,
+        request != NULL ? _mcd_request_get_handler_hint (request) : NULL,
+        account != NULL ? mcd_account_get_object_path (account) : NULL,
         request_properties,
         channel, must_have_unique_name);
     n_handlers = g_list_length (handlers);
@@ -238,12 +317,148 @@ on_operation_finished (McdDispatchOperation *operation,
     }
 }
 
+static void mcd_dispatcher_start_queued_operations (McdDispatcher *self);
+
+static void
+mcd_dispatcher_operation_released_cb (McdDispatchOperation *operation,
+                                      McdDispatcher *self)
+{
+    g_signal_handlers_disconnect_by_func (operation,
+        mcd_dispatcher_operation_released_cb, self);
+
+    g_return_if_fail (self->priv->n_running_operations > 0);
+    self->priv->n_running_operations--;
+
+    mcd_dispatcher_start_queued_operations (self);
+}
+
+static void
+mcd_dispatcher_start_operation (McdDispatcher *self,
+                                McdDispatchOperation *operation)
+{
+    self->priv->n_running_operations++;
+    g_signal_connect_object (operation, "released",
+        G_CALLBACK (mcd_dispatcher_operation_released_cb), self, 0);
+
+    _mcd_dispatch_operation_run_clients (operation);
+}
+
+static McdDispatchOperation *
+mcd_dispatcher_pop_queued_operation (McdDispatcher *self)
+{
+    McdDispatcherPrivate *priv = self->priv;
+    guint lane;
+    gboolean refilled = FALSE;
+
+    if (!g_queue_is_empty (priv->queued_operations[MCD_DISPATCH_LANE_EMERGENCY]))
+        return g_queue_pop_head (
+            priv->queued_operations[MCD_DISPATCH_LANE_EMERGENCY]);
+
+    while (TRUE)
+    {
+        gboolean any_queued = FALSE;
+
+        for (lane = MCD_DISPATCH_LANE_USER_ACTION;
+             lane < MCD_DISPATCH_N_LANES;
+             lane++)
+        {
+            if (g_queue_is_empty (priv->queued_operations[lane]))
+                continue;
+
+            any_queued = TRUE;
+
+            if (priv->lane_credits[lane] > 0)
+            {
+                priv->lane_credits[lane]--;
+                return g_queue_pop_head (priv->queued_operations[lane]);
+            }
+        }
+
+        if (!any_queued || refilled)
+            return NULL;
+
+        /* every lane with work waiting has used up its turn: start a new
+         * round */
+        for (lane = 0; lane < MCD_DISPATCH_N_LANES; lane++)
+            priv->lane_credits[lane] = lane_weights[lane];
+
+        refilled = TRUE;
+    }
+}
+
+static void
+mcd_dispatcher_start_queued_operations (McdDispatcher *self)
+{
+    guint max = mcd_dispatcher_get_max_running_operations ();
+
+    /* operations that release themselves immediately would otherwise make
+     * us recurse once per queued operation */
+    if (self->priv->starting_operations)
+        return;
+
+    self->priv->starting_operations = TRUE;
+
+    while (max == 0 || self->priv->n_running_operations < max)
+    {
+        McdDispatchOperation *operation =
+            mcd_dispatcher_pop_queued_operation (self);
+
+        if (operation == NULL)
+            break;
+
+        DEBUG ("starting queued operation %p", operation);
+
+        if (_mcd_dispatch_operation_peek_channel (operation) == NULL)
+            DEBUG ("No channels left");
+        else
+            mcd_dispatcher_start_operation (self, operation);
+
+        g_object_unref (operation);
+    }
+
+    self->priv->starting_operations = FALSE;
+}
+
+/*
+ * Run @operation's clients now, or as soon as fewer than
+ * MC_DISPATCH_CONCURRENCY other operations are running and no operation in
+ * a more important lane is waiting. Emergency calls are never held back.
+ */
+static void
+mcd_dispatcher_admit_operation (McdDispatcher *self,
+                                McdDispatchOperation *operation,
+                                McdDispatchLane lane)
+{
+    guint max = mcd_dispatcher_get_max_running_operations ();
+    guint queued = 0;
+    guint i;
+
+    for (i = 0; i < MCD_DISPATCH_N_LANES; i++)
+        queued += g_queue_get_length (self->priv->queued_operations[i]);
+
+    if (lane == MCD_DISPATCH_LANE_EMERGENCY ||
+        (queued == 0 &&
+         (max == 0 || self->priv->n_running_operations < max)))
+    {
+        DEBUG ("starting %s operation %p", lane_names[lane], operation);
+        mcd_dispatcher_start_operation (self, operation);
+        return;
+    }
+
+    DEBUG ("%u operations running, queueing %s operation %p behind %u others",
+           self->priv->n_running_operations, lane_names[lane], operation,
+           queued);
+    g_queue_push_tail (self->priv->queued_operations[lane],
+                       g_object_ref (operation));
+}
+
 static void
 _mcd_dispatcher_enter_state_machine (McdDispatcher *dispatcher,
                                      McdChannel *channel,
                                      const gchar * const *possible_handlers,
                                      gboolean requested,
-                                     gboolean only_observe)
+                                     gboolean only_observe,
+                                     McdDispatchLane lane)
 {
     McdDispatchOperation *operation;
     McdDispatcherPrivate *priv;
@@ -312,7 +527,7 @@ _mcd_dispatcher_enter_state_machine (McdDispatcher *dispatcher,
     }
     else
     {
-        _mcd_dispatch_operation_run_clients (operation);
+        mcd_dispatcher_admit_operation (dispatcher, operation, lane);
     }
 
     g_object_unref (operation);
@@ -447,6 +662,20 @@ mcd_dispatcher_client_handling_channel_cb (McdClientProxy *client,
                                        object_path, unique_name, bus_name);
 }
 
+static void
+mcd_dispatcher_client_handled_channels_listed_cb (McdClientProxy *client,
+                                                  const GPtrArray *paths,
+                                                  McdDispatcher *self)
+{
+    const gchar *unique_name = _mcd_client_proxy_get_unique_name (client);
+
+    if (unique_name == NULL || unique_name[0] == '\0')
+        return;
+
+    _mcd_handler_map_forget_unlisted (self->priv->handler_map, unique_name,
+                                      paths);
+}
+
 static void mcd_dispatcher_update_client_caps (McdDispatcher *self,
                                                McdClientProxy *client);
 
@@ -473,6 +702,9 @@ mcd_dispatcher_discard_client (McdDispatcher *self,
     g_signal_handlers_disconnect_by_func (client,
         mcd_dispatcher_client_handling_channel_cb, self);
 
+    g_signal_handlers_disconnect_by_func (client,
+        mcd_dispatcher_client_handled_channels_listed_cb, self);
+
     g_signal_handlers_disconnect_by_func (client,
                                           mcd_dispatcher_client_gone_cb,
                                           self);
@@ -486,6 +718,11 @@ mcd_dispatcher_client_gone_cb (McdClientProxy *client,
                                McdDispatcher *self)
 {
     mcd_dispatcher_discard_client (self, client);
+
+    /* if it had capabilities, mcd_dispatcher_push_client_caps() will tell
+     * the connections it has none, whether or not we remember them */
+    g_hash_table_remove (self->priv->pushed_caps,
+                         tp_proxy_get_bus_name (client));
 }
 
 /*
@@ -549,7 +786,7 @@ _mcd_dispatcher_lookup_handler (McdDispatcher *self,
         possible_handlers = _mcd_client_registry_list_possible_handlers (
                 self->priv->clients,
                 request != NULL ? _mcd_request_get_preferred_handler (request) : NULL,
-                request_properties, channel, unique_name);
+                NULL, request_properties, channel, unique_name);
         tp_clear_pointer (&request_properties, g_variant_unref);
 
         if (possible_handlers != NULL)
@@ -573,19 +810,123 @@ _mcd_dispatcher_lookup_handler (McdDispatcher *self,
     return handler;
 }
 
+/* Channels to be passed to one recovering Observer in one call */
+typedef struct {
+    /* borrowed */
+    const gchar *account_path;
+    /* borrowed TpChannel, all from the same connection */
+    GList *channels;
+} RecoveryBatch;
+
+static void
+recovery_batch_free (gpointer p)
+{
+    RecoveryBatch *batch = p;
+
+    g_list_free (batch->channels);
+    g_slice_free (RecoveryBatch, batch);
+}
+
+static void
+recovery_batches_add (GHashTable *batches,
+                      TpChannel *channel,
+                      const gchar *account_path)
+{
+    const gchar *conn_path =
+        tp_proxy_get_object_path (tp_channel_get_connection (channel));
+    RecoveryBatch *batch = g_hash_table_lookup (batches, conn_path);
+
+    if (batch == NULL)
+    {
+        batch = g_slice_new0 (RecoveryBatch);
+        g_hash_table_insert (batches, (gchar *) conn_path, batch);
+    }
+
+    if (batch->account_path == NULL)
+        batch->account_path = account_path;
+
+    batch->channels = g_list_prepend (batch->channels, channel);
+}
+
+/*
+ * Returns: (transfer full): the ChannelType that each of @filters requires,
+ *  or %NULL if at least one of them could match any channel type
+ */
+static GPtrArray *
+dup_observed_channel_types (const GList *filters)
+{
+    GPtrArray *types = g_ptr_array_new ();
+    const GList *list;
+
+    for (list = filters; list != NULL; list = list->next)
+    {
+        const gchar *type = tp_asv_get_string (list->data,
+                                               TP_PROP_CHANNEL_CHANNEL_TYPE);
+        guint i;
+
+        if (type == NULL)
+        {
+            g_ptr_array_unref (types);
+            return NULL;
+        }
+
+        for (i = 0; i < types->len; i++)
+        {
+            if (!tp_strdiff (g_ptr_array_index (types, i), type))
+                break;
+        }
+
+        if (i == types->len)
+            g_ptr_array_add (types, (gchar *) type);
+    }
+
+    return types;
+}
+
 static void
 mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
                                          McdDispatcher *self)
 {
-    const GList *channels =
-        _mcd_handler_map_get_handled_channels (self->priv->handler_map);
+    GList *channels = NULL;
     const GList *observer_filters;
     const GList *list;
+    GHashTable *batches;
+    GHashTableIter iter;
+    gpointer v;
+    GPtrArray *types;
 
     DEBUG ("called");
 
     observer_filters = _mcd_client_proxy_get_observer_filters (client);
 
+    if (observer_filters == NULL)
+        return;
+
+    /* borrowed connection path => owned RecoveryBatch */
+    batches = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                     recovery_batch_free);
+
+    /* Observer filters nearly always specify a ChannelType, so we only need
+     * to look at channels of those types */
+    types = dup_observed_channel_types (observer_filters);
+
+    if (types == NULL)
+    {
+        channels =
+            _mcd_handler_map_get_handled_channels (self->priv->handler_map);
+    }
+    else
+    {
+        guint i;
+
+        for (i = 0; i < types->len; i++)
+            channels = g_list_concat (channels,
+                _mcd_handler_map_get_handled_channels_of_type (
+                    self->priv->handler_map, g_ptr_array_index (types, i)));
+
+        g_ptr_array_unref (types);
+    }
+
     for (list = channels; list; list = list->next)
     {
         TpChannel *channel = list->data;
@@ -600,12 +941,14 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
                 _mcd_handler_map_get_channel_account (self->priv->handler_map,
                     tp_proxy_get_object_path (channel));
 
-            _mcd_client_recover_observer (client, channel, account_path);
+            recovery_batches_add (batches, channel, account_path);
         }
 
         g_variant_unref (properties);
     }
 
+    g_list_free (channels);
+
     /* we also need to think about channels that are still being dispatched,
      * but have got far enough that this client wouldn't otherwise see them */
     for (list = self->priv->operations; list != NULL; list = list->next)
@@ -625,7 +968,7 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
                 if (_mcd_client_match_filters (properties, observer_filters,
                         FALSE))
                 {
-                    _mcd_client_recover_observer (client,
+                    recovery_batches_add (batches,
                         mcd_channel_get_tp_channel (mcd_channel),
                         _mcd_dispatch_operation_get_account_path (op));
                 }
@@ -634,6 +977,20 @@ mcd_dispatcher_client_needs_recovery_cb (McdClientProxy *client,
             }
         }
     }
+
+    /* one ObserveChannels call per connection, rather than per channel */
+    g_hash_table_iter_init (&iter, batches);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        RecoveryBatch *batch = v;
+
+        batch->channels = g_list_reverse (batch->channels);
+        _mcd_client_recover_observer (client, batch->channels,
+                                      batch->account_path);
+    }
+
+    g_hash_table_unref (batches);
 }
 
 static void
@@ -649,6 +1006,9 @@ mcd_dispatcher_client_added_cb (McdClientRegistry *clients,
                       G_CALLBACK (mcd_dispatcher_client_handling_channel_cb),
                       self);
 
+    g_signal_connect (client, "handled-channels-listed",
+        G_CALLBACK (mcd_dispatcher_client_handled_channels_listed_cb), self);
+
     g_signal_connect (client, "handler-capabilities-changed",
                       G_CALLBACK (mcd_dispatcher_client_capabilities_changed_cb),
                       self);
@@ -659,6 +1019,45 @@ mcd_dispatcher_client_added_cb (McdClientRegistry *clients,
 
 }
 
+/* How long to collect Handlers' capability changes before sending them to
+ * connections, in milliseconds */
+#define PUSH_CAPS_DELAY 200
+
+/*
+ * mcd_dispatcher_caps_changed:
+ * @va: a HandlerCapabilities struct
+ * @self: the dispatcher
+ *
+ * Returns: %TRUE if @va differs from what we last sent to connections for
+ *  the same Handler, in which case it is remembered as what we sent
+ */
+static gboolean
+mcd_dispatcher_caps_changed (GValueArray *va,
+                             McdDispatcher *self)
+{
+    GValue value = G_VALUE_INIT;
+    GVariant *variant;
+    GVariant *previous;
+    const gchar *name = g_value_get_string (va->values + 0);
+
+    g_value_init (&value, TP_STRUCT_TYPE_HANDLER_CAPABILITIES);
+    g_value_set_static_boxed (&value, va);
+    variant = g_variant_ref_sink (dbus_g_value_build_g_variant (&value));
+    g_value_unset (&value);
+
+    previous = g_hash_table_lookup (self->priv->pushed_caps, name);
+
+    if (previous != NULL && g_variant_equal (previous, variant))
+    {
+        DEBUG ("%s's capabilities have not really changed", name);
+        g_variant_unref (variant);
+        return FALSE;
+    }
+
+    g_hash_table_replace (self->priv->pushed_caps, g_strdup (name), variant);
+    return TRUE;
+}
+
 static void
 mcd_dispatcher_client_registry_ready_cb (McdClientRegistry *clients,
                                          McdDispatcher *self)
@@ -678,7 +1077,7 @@ mcd_dispatcher_client_registry_ready_cb (McdClientRegistry *clients,
         _mcd_connection_start_dispatching (p, vas);
     }
 
-    g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
+    g_ptr_array_foreach (vas, (GFunc) mcd_dispatcher_caps_changed, self);
     g_ptr_array_unref (vas);
 }
 
@@ -696,6 +1095,7 @@ static void
 _mcd_dispatcher_dispose (GObject * object)
 {
     McdDispatcherPrivate *priv = MCD_DISPATCHER_PRIV (object);
+    guint i;
 
     if (priv->is_disposed)
     {
@@ -709,6 +1109,15 @@ _mcd_dispatcher_dispose (GObject * object)
         tp_clear_pointer (&priv->operations, g_list_free);
     }
 
+    for (i = 0; i < MCD_DISPATCH_N_LANES; i++)
+    {
+        if (priv->queued_operations[i] != NULL)
+        {
+            g_queue_free_full (priv->queued_operations[i], g_object_unref);
+            priv->queued_operations[i] = NULL;
+        }
+    }
+
     tp_clear_object (&priv->handler_map);
 
     if (priv->clients != NULL)
@@ -735,19 +1144,106 @@ _mcd_dispatcher_dispose (GObject * object)
 
     tp_clear_pointer (&priv->connections, g_hash_table_unref);
     tp_clear_object (&priv->master);
+
+    if (priv->push_caps_id != 0)
+    {
+        g_source_remove (priv->push_caps_id);
+        priv->push_caps_id = 0;
+    }
+
+    tp_clear_pointer (&priv->changed_caps, g_hash_table_unref);
+    tp_clear_pointer (&priv->pushed_caps, g_hash_table_unref);
+
+    if (priv->dbus_daemon != NULL)
+        _mcd_dispatch_stats_unexport (priv->dbus_daemon);
+
     tp_clear_object (&priv->dbus_daemon);
 
     G_OBJECT_CLASS (mcd_dispatcher_parent_class)->dispose (object);
 }
 
-static void
-mcd_dispatcher_update_client_caps (McdDispatcher *self,
-                                   McdClientProxy *client)
+static gboolean
+mcd_dispatcher_push_client_caps (gpointer data)
 {
+    McdDispatcher *self = data;
     GPtrArray *vas;
+    GPtrArray *vanished;
     GHashTableIter iter;
     gpointer k;
+    guint i;
+
+    self->priv->push_caps_id = 0;
+
+    vas = g_ptr_array_sized_new (g_hash_table_size (self->priv->changed_caps));
+    vanished = g_ptr_array_new_with_free_func (
+        (GDestroyNotify) g_value_array_free);
+
+    g_hash_table_iter_init (&iter, self->priv->changed_caps);
+
+    while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+        McdClientProxy *client = _mcd_client_registry_lookup (
+            self->priv->clients, k);
+        GValueArray *va;
+
+        if (client != NULL)
+        {
+            va = _mcd_client_proxy_get_handler_capabilities (client);
+        }
+        else
+        {
+            /* it has gone away since it changed: tell the connections that
+             * it can no longer handle anything */
+            GPtrArray *no_filters = g_ptr_array_new ();
+            const gchar * const no_tokens[] = { NULL };
+
+            va = tp_value_array_build (3,
+                G_TYPE_STRING, k,
+                TP_ARRAY_TYPE_CHANNEL_CLASS_LIST, no_filters,
+                G_TYPE_STRV, no_tokens,
+                G_TYPE_INVALID);
+            g_ptr_array_unref (no_filters);
+            g_ptr_array_add (vanished, va);
+        }
+
+        if (mcd_dispatcher_caps_changed (va, self))
+            g_ptr_array_add (vas, va);
+    }
+
+    g_hash_table_remove_all (self->priv->changed_caps);
+
+    if (vas->len > 0)
+    {
+        DEBUG ("sending %u changed Handlers' capabilities to %u connections",
+               vas->len, g_hash_table_size (self->priv->connections));
+
+        g_hash_table_iter_init (&iter, self->priv->connections);
+
+        while (g_hash_table_iter_next (&iter, &k, NULL))
+        {
+            _mcd_connection_update_client_caps (k, vas);
+        }
+    }
+
+    /* there's no need to remember that Handlers that have gone away have no
+     * capabilities: if they come back, they'll be pushed anyway */
+    for (i = 0; i < vanished->len; i++)
+    {
+        GValueArray *va = g_ptr_array_index (vanished, i);
+
+        g_hash_table_remove (self->priv->pushed_caps,
+                             g_value_get_string (va->values + 0));
+    }
 
+    g_ptr_array_unref (vas);
+    g_ptr_array_unref (vanished);
+    return FALSE;
+}
+
+static void
+mcd_dispatcher_update_client_caps (McdDispatcher *self,
+                                   McdClientProxy *client)
+{
     /* If we haven't finished inspecting initial clients yet, we'll push all
      * the client caps into all connections when we do, so do nothing.
      *
@@ -759,18 +1255,15 @@ mcd_dispatcher_update_client_caps (McdDispatcher *self,
         return;
     }
 
-    vas = g_ptr_array_sized_new (1);
-    g_ptr_array_add (vas, _mcd_client_proxy_dup_handler_capabilities (client));
-
-    g_hash_table_iter_init (&iter, self->priv->connections);
-
-    while (g_hash_table_iter_next (&iter, &k, NULL))
-    {
-        _mcd_connection_update_client_caps (k, vas);
-    }
+    /* Handlers tend to start up (or exit) in groups, for instance at login:
+     * wait a moment, so that each connection gets one UpdateCapabilities
+     * call for the whole group */
+    g_hash_table_add (self->priv->changed_caps,
+                      g_strdup (tp_proxy_get_bus_name (client)));
 
-    g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
-    g_ptr_array_unref (vas);
+    if (self->priv->push_caps_id == 0)
+        self->priv->push_caps_id = g_timeout_add (PUSH_CAPS_DELAY,
+            mcd_dispatcher_push_client_caps, self);
 }
 
 static void
@@ -806,6 +1299,8 @@ mcd_dispatcher_constructed (GObject *object)
     dbus_g_connection_register_g_object (dgc,
                                          TP_CHANNEL_DISPATCHER_OBJECT_PATH,
                                          object);
+
+    _mcd_dispatch_stats_export (priv->dbus_daemon);
 }
 
 static void
@@ -883,6 +1378,7 @@ static void
 mcd_dispatcher_init (McdDispatcher * dispatcher)
 {
     McdDispatcherPrivate *priv;
+    guint i;
 
     priv = G_TYPE_INSTANCE_GET_PRIVATE (dispatcher, MCD_TYPE_DISPATCHER,
                                         McdDispatcherPrivate);
@@ -891,6 +1387,16 @@ mcd_dispatcher_init (McdDispatcher * dispatcher)
     priv->operation_list_active = FALSE;
 
     priv->connections = g_hash_table_new (NULL, NULL);
+    priv->changed_caps = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    priv->pushed_caps = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) g_variant_unref);
+
+    for (i = 0; i < MCD_DISPATCH_N_LANES; i++)
+    {
+        priv->queued_operations[i] = g_queue_new ();
+        priv->lane_credits[i] = lane_weights[i];
+    }
 
     /* idempotent, not guaranteed to have been called yet */
     _mcd_plugin_loader_init ();
@@ -907,19 +1413,53 @@ mcd_dispatcher_new (TpDBusDaemon *dbus_daemon, McdMaster *master)
     return obj;
 }
 
-/*
- * _mcd_dispatcher_add_channel:
- * @dispatcher: the #McdDispatcher.
- * @channel: (transfer none): a #McdChannel which must own a #TpChannel
- * @requested: whether the channels were requested by MC.
- *
- * Add @channel to the dispatching state machine.
- */
-void
-_mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
-                             McdChannel *channel,
-                             gboolean requested,
-                             gboolean only_observe)
+static McdDispatchLane
+mcd_dispatcher_classify_channel (McdChannel *channel,
+                                 McdRequest *request,
+                                 gboolean requested,
+                                 gboolean recovered)
+{
+    McdAccount *account = mcd_channel_get_account (channel);
+    McdConnection *connection = NULL;
+    TpChannel *tp_channel = mcd_channel_get_tp_channel (channel);
+
+    if (request != NULL && _mcd_request_is_urgent (request))
+        return MCD_DISPATCH_LANE_EMERGENCY;
+
+    if (account != NULL)
+        connection = mcd_account_get_connection (account);
+
+    if (connection != NULL && tp_channel != NULL)
+    {
+        const gchar *target_id = tp_channel_get_identifier (tp_channel);
+        TpHandleType handle_type;
+        TpHandle handle = tp_channel_get_handle (tp_channel, &handle_type);
+
+        if ((!tp_str_empty (target_id) &&
+             _mcd_connection_target_id_is_urgent (connection, target_id)) ||
+            (handle_type == TP_HANDLE_TYPE_CONTACT &&
+             _mcd_connection_target_handle_is_urgent (connection, handle)))
+            return MCD_DISPATCH_LANE_EMERGENCY;
+    }
+
+    if (recovered)
+        return MCD_DISPATCH_LANE_BACKGROUND;
+
+    if (!requested)
+        return MCD_DISPATCH_LANE_INCOMING;
+
+    if (request != NULL && _mcd_request_get_user_action_time (request) != 0)
+        return MCD_DISPATCH_LANE_USER_ACTION;
+
+    return MCD_DISPATCH_LANE_BACKGROUND;
+}
+
+static void
+mcd_dispatcher_add_channel_full (McdDispatcher *dispatcher,
+                                 McdChannel *channel,
+                                 gboolean requested,
+                                 gboolean only_observe,
+                                 gboolean recovered)
 {
     TpChannel *tp_channel = NULL;
     GStrv possible_handlers;
@@ -941,7 +1481,8 @@ _mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
         /* these channels were requested "behind our back", so only call
          * ObserveChannels on them */
         _mcd_dispatcher_enter_state_machine (dispatcher, channel, NULL,
-                                             TRUE, TRUE);
+                                             TRUE, TRUE,
+                                             MCD_DISPATCH_LANE_BACKGROUND);
         return;
     }
 
@@ -958,9 +1499,7 @@ _mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
         possible_handlers = mcd_dispatcher_dup_internal_handlers ();
     else
         possible_handlers = mcd_dispatcher_dup_possible_handlers (dispatcher,
-                                                                  request,
-                                                                  tp_channel,
-                                                                  NULL);
+            mcd_channel_get_account (channel), request, tp_channel, NULL);
 
     if (possible_handlers == NULL)
     {
@@ -976,11 +1515,31 @@ _mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
     _mcd_channel_set_status (channel, MCD_CHANNEL_STATUS_DISPATCHING);
 
     _mcd_dispatcher_enter_state_machine (dispatcher, channel,
-        (const gchar * const *) possible_handlers, requested, FALSE);
+        (const gchar * const *) possible_handlers, requested, FALSE,
+        mcd_dispatcher_classify_channel (channel, request, requested,
+                                         recovered));
 
     g_strfreev (possible_handlers);
 }
 
+/*
+ * _mcd_dispatcher_add_channel:
+ * @dispatcher: the #McdDispatcher.
+ * @channel: (transfer none): a #McdChannel which must own a #TpChannel
+ * @requested: whether the channels were requested by MC.
+ *
+ * Add @channel to the dispatching state machine.
+ */
+void
+_mcd_dispatcher_add_channel (McdDispatcher *dispatcher,
+                             McdChannel *channel,
+                             gboolean requested,
+                             gboolean only_observe)
+{
+    mcd_dispatcher_add_channel_full (dispatcher, channel, requested,
+                                     only_observe, FALSE);
+}
+
 static void
 mcd_dispatcher_finish_reinvocation (McdChannel *request)
 {
@@ -1187,7 +1746,8 @@ _mcd_dispatcher_recover_channel (McdDispatcher *dispatcher,
         DEBUG ("%s is unhandled, redispatching", path);
 
         requested = mcd_channel_is_requested (channel);
-        _mcd_dispatcher_add_channel (dispatcher, channel, requested, FALSE);
+        mcd_dispatcher_add_channel_full (dispatcher, channel, requested,
+                                         FALSE, TRUE);
     }
 }
 
@@ -1414,6 +1974,14 @@ _mcd_dispatcher_add_connection (McdDispatcher *self,
     DEBUG ("%p: %p (%s)", self, connection,
            mcd_connection_get_object_path (connection));
 
+    /* bring the existing connections up to date first, so that what we
+     * remember having sent is true for all connections */
+    if (self->priv->push_caps_id != 0)
+    {
+        g_source_remove (self->priv->push_caps_id);
+        mcd_dispatcher_push_client_caps (self);
+    }
+
     g_hash_table_insert (self->priv->connections, connection, connection);
     g_object_weak_ref ((GObject *) connection, mcd_dispatcher_lost_connection,
                        g_object_ref (self));
@@ -1424,8 +1992,7 @@ _mcd_dispatcher_add_connection (McdDispatcher *self,
             _mcd_client_registry_dup_client_caps (self->priv->clients);
 
         _mcd_connection_start_dispatching (connection, vas);
-
-        g_ptr_array_foreach (vas, (GFunc) g_value_array_free, NULL);
+        g_ptr_array_foreach (vas, (GFunc) mcd_dispatcher_caps_changed, self);
         g_ptr_array_unref (vas);
     }
     /* else _mcd_connection_start_dispatching will be called when we're ready
@@ -1716,6 +2283,11 @@ messages_iface_init (gpointer iface, gpointer data G_GNUC_UNUSED)
 #undef IMPLEMENT
 }
 
+/* How many channels from one DelegateChannels call may be waiting for a
+ * Handler's reply at the same time. Each channel is only ever offered to one
+ * Handler at a time. */
+#define DELEGATE_MAX_IN_FLIGHT 8
+
 typedef struct
 {
     McdDispatcher *self;
@@ -1723,6 +2295,15 @@ typedef struct
     DBusGMethodInvocation *context;
     /* List of owned ChannelToDelegate */
     GList *channels;
+    /* Queue of borrowed ChannelToDelegate that we haven't started on yet */
+    GQueue *pending;
+    /* number of channels we have started on, but not yet delegated or
+     * given up on */
+    guint in_flight;
+    /* number of channels that have not yet been delegated or given up on */
+    guint unresolved;
+    /* TRUE while we are starting pending channels */
+    gboolean starting;
     /* array of owned channel path */
     GPtrArray *delegated;
     /* owned channel path -> owned GValueArray representing a
@@ -1739,6 +2320,8 @@ typedef struct
     /* Queue of reffed McdClientProxy */
     GQueue *handlers;
     GError *error;
+    /* TRUE if the channel has been delegated or we have given up */
+    gboolean resolved;
 }   ChannelToDelegate;
 
 static ChannelToDelegate *
@@ -1784,6 +2367,7 @@ delegate_channels_ctx_new (McdDispatcher *self,
     ctx->user_action_time = user_action_time;
     ctx->context = context;
     ctx->channels = NULL;
+    ctx->pending = g_queue_new ();
     ctx->delegated = g_ptr_array_new_with_free_func (g_free);
     ctx->not_delegated = g_hash_table_new_full (g_str_hash, g_str_equal,
         g_free, free_not_delegated_error);
@@ -1794,6 +2378,7 @@ static void
 delegate_channels_ctx_free (DelegateChannelsCtx *ctx)
 {
     g_object_unref (ctx->self);
+    g_queue_free (ctx->pending);
     g_ptr_array_unref (ctx->delegated);
     g_hash_table_unref (ctx->not_delegated);
     g_list_free_full (ctx->channels, (GDestroyNotify) channel_to_delegate_free);
@@ -1802,24 +2387,49 @@ delegate_channels_ctx_free (DelegateChannelsCtx *ctx)
 
 static void try_delegating (ChannelToDelegate *to_delegate);
 
+/*
+ * Start on as many pending channels as DELEGATE_MAX_IN_FLIGHT allows. If
+ * that leaves nothing unresolved, reply to DelegateChannels and free @ctx.
+ */
 static void
-delegation_done (ChannelToDelegate *to_delegate)
+delegate_channels_continue (DelegateChannelsCtx *ctx)
 {
-    DelegateChannelsCtx *ctx = to_delegate->ctx;
+    if (ctx->starting)
+        return;
 
-    ctx->channels = g_list_remove (ctx->channels, to_delegate);
-    channel_to_delegate_free (to_delegate);
+    ctx->starting = TRUE;
 
-    if (ctx->channels == NULL)
+    while (ctx->in_flight < DELEGATE_MAX_IN_FLIGHT &&
+           !g_queue_is_empty (ctx->pending))
+      {
+        ctx->in_flight++;
+        try_delegating (g_queue_pop_head (ctx->pending));
+      }
+
+    ctx->starting = FALSE;
+
+    if (ctx->unresolved == 0)
       {
         /* We are done */
         tp_svc_channel_dispatcher_return_from_delegate_channels (
             ctx->context, ctx->delegated, ctx->not_delegated);
-
         delegate_channels_ctx_free (ctx);
       }
 }
 
+static void
+delegation_done (ChannelToDelegate *to_delegate)
+{
+    DelegateChannelsCtx *ctx = to_delegate->ctx;
+
+    g_return_if_fail (!to_delegate->resolved);
+
+    to_delegate->resolved = TRUE;
+    ctx->in_flight--;
+    ctx->unresolved--;
+    delegate_channels_continue (ctx);
+}
+
 static void
 delegate_channels_cb (TpClient *client,
     const GError *error,
@@ -1912,6 +2522,9 @@ try_delegating (ChannelToDelegate *to_delegate)
 
     channels = g_list_prepend (channels, to_delegate->channel);
 
+    /* we only move on to the next Handler when this one has refused the
+     * channel or the call has timed out, so the channel never has two
+     * Handlers at once */
     _mcd_client_proxy_handle_channels (client, -1, channels,
         to_delegate->ctx->user_action_time, NULL, delegate_channels_cb,
         to_delegate, NULL, NULL);
@@ -1931,7 +2544,8 @@ add_possible_handlers (McdDispatcher *self,
     guint i;
 
     possible_handlers = mcd_dispatcher_dup_possible_handlers (self,
-        NULL, tp_channel, NULL);
+        mcd_channel_get_account (to_delegate->channel), NULL, tp_channel,
+        NULL);
 
     for (i = 0; possible_handlers[i] != NULL; i++)
       {
@@ -1974,7 +2588,6 @@ dispatcher_delegate_channels (
     DelegateChannelsCtx *ctx = NULL;
     McdAccountManager *am = NULL;
     guint i;
-    GList *l;
 
     DEBUG ("called");
 
@@ -2044,15 +2657,12 @@ dispatcher_delegate_channels (
             preferred_handler);
 
         ctx->channels = g_list_prepend (ctx->channels, to_delegate);
+        g_queue_push_tail (ctx->pending, to_delegate);
+        ctx->unresolved++;
       }
 
     /* All the channels were ok, we can start delegating */
-    for (l = ctx->channels; l != NULL; l = g_list_next (l))
-      {
-        ChannelToDelegate *to_delegate = l->data;
-
-        try_delegating (to_delegate);
-      }
+    delegate_channels_continue (ctx);
 
     g_free (sender);
     g_object_unref (am);
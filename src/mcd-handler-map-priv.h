@@ -80,8 +80,15 @@ void _mcd_handler_map_set_channel_handled (McdHandlerMap *self,
                                            const gchar *well_known_name,
                                            const gchar *account_path);
 
+void _mcd_handler_map_forget_unlisted (McdHandlerMap *self,
+                                       const gchar *unique_name,
+                                       const GPtrArray *listed);
+
 GList *_mcd_handler_map_get_handled_channels (McdHandlerMap *self);
 
+GList *_mcd_handler_map_get_handled_channels_of_type (McdHandlerMap *self,
+    const gchar *channel_type);
+
 const gchar *_mcd_handler_map_get_channel_account (McdHandlerMap *self,
                                                    const gchar *channel_path);
 
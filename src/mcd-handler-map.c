@@ -26,28 +26,82 @@
 #include "config.h"
 #include "mcd-handler-map-priv.h"
 
+#include <errno.h>
+#include <stdlib.h>
+
+#include <glib/gstdio.h>
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "channel-utils.h"
 #include "mcd-channel-priv.h"
+#include "mcd-debug.h"
+
+/* How long to wait for more changes before rewriting the snapshot */
+#define SNAPSHOT_DELAY_MS 500
+
+/* How long a channel restored from the snapshot may go unconfirmed, either
+ * by its handler's HandledChannels or by seeing it on a connection, before
+ * we assume it has gone away */
+#define SNAPSHOT_CONFIRM_TIMEOUT_MS (60 * 1000)
 
 G_DEFINE_TYPE (McdHandlerMap, _mcd_handler_map, G_TYPE_OBJECT);
 
+typedef struct _HandlerProcess HandlerProcess;
+
+/* Everything we know about one channel that is being handled */
+typedef struct {
+    /* owned */
+    gchar *object_path;
+    /* the process handling it, or NULL if that process has exited */
+    HandlerProcess *handler;
+    /* The well-known bus name we invoked, or NULL if not known;
+     * interned */
+    const gchar *well_known_name;
+    /* interned, or NULL if not known */
+    const gchar *account_path;
+    /* ref'd, or NULL if we only know the object path */
+    TpChannel *channel;
+    /* interned ChannelType of @channel, or NULL if @channel is NULL */
+    const gchar *channel_type;
+    /* our entry in handler->channels; link.data points back to us */
+    GList link;
+    /* our entry in by_type[channel_type]; type_link.data points back to us */
+    GList type_link;
+    /* TRUE if we only know about this channel from the snapshot, and its
+     * handler has not confirmed it yet */
+    gboolean from_snapshot;
+} HandledChannel;
+
+struct _HandlerProcess {
+    /* owned */
+    gchar *unique_name;
+    /* HandledChannel, linked through their @link member */
+    GQueue channels;
+};
+
 struct _McdHandlerMapPrivate
 {
     TpDBusDaemon *dbus_daemon;
-    /* The handler for each channel currently being handled
-     * owned gchar *object_path => owned gchar *unique_name */
-    GHashTable *channel_processes;
-    /* The well-known bus name we invoked in channel_processes[path]
-     * owned gchar *object_path => owned gchar *well_known_name */
-    GHashTable *channel_clients;
-    /* owned gchar *unique_name => malloc'd gsize, number of channels */
-    GHashTable *handler_processes;
-    /* owned gchar *object_path => ref'd TpChannel */
-    GHashTable *handled_channels;
-    /* owned gchar *object_path =>  owned gchar *account_path */
-    GHashTable *channel_accounts;
+    /* borrowed gchar *object_path => owned HandledChannel */
+    GHashTable *channels;
+    /* Processes handling at least one channel in @channels, each with a
+     * name-owner watch
+     * borrowed gchar *unique_name => owned HandlerProcess */
+    GHashTable *handlers;
+    /* HandledChannel with a TpChannel, by channel type, linked through
+     * their @type_link member
+     * interned gchar *channel_type => owned GQueue */
+    GHashTable *by_type;
+
+    /* Where we save enough of @channels to pick up where we left off if
+     * we are restarted, or NULL if there's nowhere suitable */
+    gchar *snapshot_path;
+    /* source ID of a pending snapshot_write_cb, or 0 */
+    guint snapshot_id;
+    /* source ID of a pending snapshot_expire_cb, or 0 */
+    guint snapshot_expiry_id;
 };
 
 enum {
@@ -56,9 +110,29 @@ enum {
 };
 
 static void
-slice_free_gsize (gpointer p)
+handled_channel_free (gpointer p)
 {
-    g_slice_free (gsize, p);
+    HandledChannel *hc = p;
+
+    tp_clear_object (&hc->channel);
+    g_free (hc->object_path);
+    g_slice_free (HandledChannel, hc);
+}
+
+static void
+handler_process_free (gpointer p)
+{
+    HandlerProcess *hp = p;
+
+    g_free (hp->unique_name);
+    g_slice_free (HandlerProcess, hp);
+}
+
+static void
+channel_queue_free (gpointer p)
+{
+    /* the links belong to the HandledChannel structs */
+    g_slice_free (GQueue, p);
 }
 
 static void
@@ -67,28 +141,14 @@ _mcd_handler_map_init (McdHandlerMap *self)
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MCD_TYPE_HANDLER_MAP,
                                               McdHandlerMapPrivate);
 
-    self->priv->channel_processes = g_hash_table_new_full (g_str_hash,
-                                                           g_str_equal,
-                                                           g_free, g_free);
-
-    self->priv->channel_clients = g_hash_table_new_full (g_str_hash,
-                                                         g_str_equal,
-                                                         g_free, g_free);
-
-    self->priv->handler_processes = g_hash_table_new_full (g_str_hash,
-                                                           g_str_equal,
-                                                           g_free,
-                                                           slice_free_gsize);
+    self->priv->channels = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL, handled_channel_free);
 
-    self->priv->handled_channels = g_hash_table_new_full (g_str_hash,
-                                                          g_str_equal,
-                                                          g_free,
-                                                          g_object_unref);
+    self->priv->handlers = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL, handler_process_free);
 
-    self->priv->channel_accounts = g_hash_table_new_full (g_str_hash,
-                                                          g_str_equal,
-                                                          g_free,
-                                                          g_free);
+    self->priv->by_type = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 NULL, channel_queue_free);
 }
 
 static void
@@ -136,21 +196,136 @@ static void mcd_handler_map_name_owner_cb (TpDBusDaemon *dbus_daemon,
                                            const gchar *new_owner,
                                            gpointer user_data);
 
+static void snapshot_write (McdHandlerMap *self);
+static void snapshot_load (McdHandlerMap *self);
+
+/* Remove the snapshots of any other buses from @dirname: their unique
+ * names are meaningless now, and nobody else will clean them up. */
+static void
+remove_other_snapshots (const gchar *dirname,
+                        const gchar *filename)
+{
+    GDir *dir = g_dir_open (dirname, 0, NULL);
+    const gchar *entry;
+
+    if (dir == NULL)
+        return;
+
+    while ((entry = g_dir_read_name (dir)) != NULL)
+    {
+        gchar *path;
+
+        if (!g_str_has_prefix (entry, "handled-channels-") ||
+            !tp_strdiff (entry, filename))
+            continue;
+
+        path = g_build_filename (dirname, entry, NULL);
+        DEBUG ("Removing stale snapshot %s", path);
+
+        if (g_unlink (path) != 0 && errno != ENOENT)
+            DEBUG ("Unable to remove %s: %s", path, g_strerror (errno));
+
+        g_free (path);
+    }
+
+    g_dir_close (dir);
+}
+
+/*
+ * The snapshot lives in XDG_RUNTIME_DIR, so it doesn't survive logging
+ * out, and is specific to the bus, because unique names are meaningless
+ * on any other bus. There's only one session bus per login session, so
+ * snapshots from any other bus are left over from one that has gone away.
+ */
+static gchar *
+dup_snapshot_path (TpDBusDaemon *dbus_daemon)
+{
+    DBusConnection *conn = dbus_g_connection_get_connection (
+        tp_proxy_get_dbus_connection (dbus_daemon));
+    const gchar *runtime_dir = g_get_user_runtime_dir ();
+    gchar *dirname;
+    gchar *filename;
+    gchar *path;
+    char *bus_id;
+
+    bus_id = dbus_bus_get_id (conn, NULL);
+
+    if (bus_id == NULL)
+        return NULL;
+
+    dirname = g_build_filename (runtime_dir, "telepathy", "mission-control",
+                                NULL);
+
+    if (g_mkdir_with_parents (dirname, 0700) != 0)
+    {
+        DEBUG ("Unable to create %s: %s", dirname, g_strerror (errno));
+        g_free (dirname);
+        dbus_free (bus_id);
+        return NULL;
+    }
+
+    filename = g_strdup_printf ("handled-channels-%s", bus_id);
+    remove_other_snapshots (dirname, filename);
+    path = g_build_filename (dirname, filename, NULL);
+    g_free (filename);
+    g_free (dirname);
+    dbus_free (bus_id);
+    return path;
+}
+
+static void
+_mcd_handler_map_constructed (GObject *object)
+{
+    McdHandlerMap *self = MCD_HANDLER_MAP (object);
+    void (*chain_up) (GObject *) =
+        G_OBJECT_CLASS (_mcd_handler_map_parent_class)->constructed;
+
+    if (chain_up != NULL)
+        chain_up (object);
+
+    g_return_if_fail (self->priv->dbus_daemon != NULL);
+
+    self->priv->snapshot_path = dup_snapshot_path (self->priv->dbus_daemon);
+
+    if (self->priv->snapshot_path != NULL)
+        snapshot_load (self);
+}
+
 static void
 _mcd_handler_map_dispose (GObject *object)
 {
     McdHandlerMap *self = MCD_HANDLER_MAP (object);
 
-    tp_clear_pointer (&self->priv->handled_channels, g_hash_table_unref);
+    /* Save anything we haven't saved yet: if we're going away, the
+     * next instance will want to know about it */
+    if (self->priv->snapshot_id != 0)
+    {
+        g_source_remove (self->priv->snapshot_id);
+        self->priv->snapshot_id = 0;
+
+        if (self->priv->channels != NULL)
+            snapshot_write (self);
+    }
+
+    if (self->priv->snapshot_expiry_id != 0)
+    {
+        g_source_remove (self->priv->snapshot_expiry_id);
+        self->priv->snapshot_expiry_id = 0;
+    }
 
-    if (self->priv->handler_processes != NULL)
+    /* the HandlerProcess structs don't own their channel lists, so
+     * they can be freed in either order */
+    tp_clear_pointer (&self->priv->by_type, g_hash_table_unref);
+    tp_clear_pointer (&self->priv->channels, g_hash_table_unref);
+
+    if (self->priv->handlers != NULL)
     {
         GHashTableIter iter;
         gpointer k;
 
         g_assert (self->priv->dbus_daemon != NULL);
 
-        g_hash_table_iter_init (&iter, self->priv->handler_processes);
+        g_hash_table_iter_init (&iter, self->priv->handlers);
 
         while (g_hash_table_iter_next (&iter, &k, NULL))
         {
@@ -160,7 +335,7 @@ _mcd_handler_map_dispose (GObject *object)
 
     }
 
-    tp_clear_pointer (&self->priv->handler_processes, g_hash_table_unref);
+    tp_clear_pointer (&self->priv->handlers, g_hash_table_unref);
     tp_clear_object (&self->priv->dbus_daemon);
 
     G_OBJECT_CLASS (_mcd_handler_map_parent_class)->dispose (object);
@@ -171,9 +346,7 @@ _mcd_handler_map_finalize (GObject *object)
 {
     McdHandlerMap *self = MCD_HANDLER_MAP (object);
 
-    tp_clear_pointer (&self->priv->channel_processes, g_hash_table_unref);
-    tp_clear_pointer (&self->priv->channel_clients, g_hash_table_unref);
-    tp_clear_pointer (&self->priv->channel_accounts, g_hash_table_unref);
+    g_free (self->priv->snapshot_path);
 
     G_OBJECT_CLASS (_mcd_handler_map_parent_class)->finalize (object);
 }
@@ -184,6 +357,7 @@ _mcd_handler_map_class_init (McdHandlerMapClass *klass)
     GObjectClass *object_class = (GObjectClass *) klass;
 
     g_type_class_add_private (object_class, sizeof (McdHandlerMapPrivate));
+    object_class->constructed = _mcd_handler_map_constructed;
     object_class->dispose = _mcd_handler_map_dispose;
     object_class->get_property = _mcd_handler_map_get_property;
     object_class->set_property = _mcd_handler_map_set_property;
@@ -204,6 +378,337 @@ _mcd_handler_map_new (TpDBusDaemon *dbus_daemon)
                          NULL);
 }
 
+/* Take @hc away from its handler, forgetting about the handler if it has
+ * no more channels. */
+static void
+handled_channel_detach (McdHandlerMap *self,
+                        HandledChannel *hc)
+{
+    HandlerProcess *hp = hc->handler;
+
+    if (hp == NULL)
+        return;
+
+    g_queue_unlink (&hp->channels, &hc->link);
+    hc->handler = NULL;
+
+    if (g_queue_is_empty (&hp->channels))
+    {
+        tp_dbus_daemon_cancel_name_owner_watch (self->priv->dbus_daemon,
+            hp->unique_name, mcd_handler_map_name_owner_cb, self);
+        /* frees hp */
+        g_hash_table_remove (self->priv->handlers, hp->unique_name);
+    }
+}
+
+static void
+handled_channel_attach (McdHandlerMap *self,
+                        HandledChannel *hc,
+                        const gchar *unique_name)
+{
+    HandlerProcess *hp = g_hash_table_lookup (self->priv->handlers,
+                                              unique_name);
+
+    g_assert (hc->handler == NULL);
+
+    if (hp == NULL)
+    {
+        hp = g_slice_new0 (HandlerProcess);
+        hp->unique_name = g_strdup (unique_name);
+        g_queue_init (&hp->channels);
+        g_hash_table_insert (self->priv->handlers, hp->unique_name, hp);
+        tp_dbus_daemon_watch_name_owner (self->priv->dbus_daemon, unique_name,
+                                         mcd_handler_map_name_owner_cb, self,
+                                         NULL);
+    }
+
+    hc->link.data = hc;
+    g_queue_push_tail_link (&hp->channels, &hc->link);
+    hc->handler = hp;
+}
+
+static void
+handled_channel_set_channel (McdHandlerMap *self,
+                             HandledChannel *hc,
+                             TpChannel *channel)
+{
+    GQueue *queue;
+
+    if (hc->channel != NULL)
+    {
+        queue = g_hash_table_lookup (self->priv->by_type, hc->channel_type);
+        g_assert (queue != NULL);
+        g_queue_unlink (queue, &hc->type_link);
+
+        if (g_queue_is_empty (queue))
+            g_hash_table_remove (self->priv->by_type, hc->channel_type);
+
+        hc->channel_type = NULL;
+        tp_clear_object (&hc->channel);
+    }
+
+    if (channel == NULL)
+        return;
+
+    hc->channel = g_object_ref (channel);
+    hc->channel_type = g_intern_string (tp_channel_get_channel_type (channel));
+
+    queue = g_hash_table_lookup (self->priv->by_type, hc->channel_type);
+
+    if (queue == NULL)
+    {
+        queue = g_slice_new0 (GQueue);
+        g_queue_init (queue);
+        g_hash_table_insert (self->priv->by_type, (gchar *) hc->channel_type,
+                             queue);
+    }
+
+    hc->type_link.data = hc;
+    g_queue_push_tail_link (queue, &hc->type_link);
+}
+
+static HandledChannel *
+ensure_handled_channel (McdHandlerMap *self,
+                        const gchar *channel_path)
+{
+    HandledChannel *hc = g_hash_table_lookup (self->priv->channels,
+                                              channel_path);
+
+    if (hc == NULL)
+    {
+        hc = g_slice_new0 (HandledChannel);
+        hc->object_path = g_strdup (channel_path);
+        g_hash_table_insert (self->priv->channels, hc->object_path, hc);
+    }
+
+    return hc;
+}
+
+/*
+ * One line per channel whose handler we know:
+ * object path, handler unique name, well-known name, account path,
+ * separated by tabs; unknown names are empty.
+ */
+static void
+snapshot_write (McdHandlerMap *self)
+{
+    GString *contents;
+    GHashTableIter iter;
+    gpointer v;
+    GError *error = NULL;
+
+    if (self->priv->snapshot_path == NULL)
+        return;
+
+    contents = g_string_new ("");
+    g_hash_table_iter_init (&iter, self->priv->channels);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        HandledChannel *hc = v;
+
+        if (hc->handler == NULL)
+            continue;
+
+        g_string_append_printf (contents, "%s\t%s\t%s\t%s\n",
+                                hc->object_path, hc->handler->unique_name,
+                                tp_str_empty (hc->well_known_name) ? "" :
+                                    hc->well_known_name,
+                                tp_str_empty (hc->account_path) ? "" :
+                                    hc->account_path);
+    }
+
+    if (contents->len == 0)
+    {
+        if (g_unlink (self->priv->snapshot_path) != 0 && errno != ENOENT)
+            DEBUG ("Unable to remove %s: %s", self->priv->snapshot_path,
+                   g_strerror (errno));
+    }
+    else if (!g_file_set_contents (self->priv->snapshot_path, contents->str,
+                                   contents->len, &error))
+    {
+        DEBUG ("Unable to save handled channels: %s", error->message);
+        g_error_free (error);
+    }
+
+    g_string_free (contents, TRUE);
+}
+
+static gboolean
+snapshot_write_cb (gpointer user_data)
+{
+    McdHandlerMap *self = MCD_HANDLER_MAP (user_data);
+
+    self->priv->snapshot_id = 0;
+    snapshot_write (self);
+    return FALSE;
+}
+
+/* Save the new state soon, coalescing any further changes into the same
+ * write */
+static void
+snapshot_schedule (McdHandlerMap *self)
+{
+    if (self->priv->snapshot_path == NULL || self->priv->snapshot_id != 0)
+        return;
+
+    self->priv->snapshot_id = g_timeout_add (SNAPSHOT_DELAY_MS,
+                                             snapshot_write_cb, self);
+}
+
+/* Forget @stale, a list of HandledChannel that we only knew about from
+ * the snapshot. Detaching the last of a handler's channels frees the
+ * HandlerProcess, so the caller must not look at it again. */
+static void
+forget_stale (McdHandlerMap *self,
+              GList *stale)
+{
+    GList *iter;
+
+    if (stale == NULL)
+        return;
+
+    snapshot_schedule (self);
+
+    for (iter = stale; iter != NULL; iter = iter->next)
+    {
+        HandledChannel *hc = iter->data;
+
+        DEBUG ("%s is no longer handled by %s", hc->object_path,
+               hc->handler->unique_name);
+
+        hc->from_snapshot = FALSE;
+        handled_channel_detach (self, hc);
+
+        if (hc->channel == NULL)
+            g_hash_table_remove (self->priv->channels, hc->object_path);
+    }
+}
+
+static gboolean
+snapshot_expire_cb (gpointer user_data)
+{
+    McdHandlerMap *self = MCD_HANDLER_MAP (user_data);
+    GHashTableIter iter;
+    gpointer v;
+    GList *stale = NULL;
+
+    self->priv->snapshot_expiry_id = 0;
+
+    g_hash_table_iter_init (&iter, self->priv->channels);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        HandledChannel *hc = v;
+
+        /* if we've seen the channel on its connection, it still exists,
+         * and it will be forgotten when it closes */
+        if (hc->from_snapshot && hc->handler != NULL && hc->channel == NULL)
+            stale = g_list_prepend (stale, hc);
+    }
+
+    forget_stale (self, stale);
+    g_list_free (stale);
+    return FALSE;
+}
+
+static guint
+get_confirm_timeout (void)
+{
+    const gchar *value = g_getenv ("MC_SNAPSHOT_CONFIRM_TIMEOUT");
+
+    if (value == NULL)
+        return SNAPSHOT_CONFIRM_TIMEOUT_MS;
+
+    return MAX (0, atoi (value));
+}
+
+/*
+ * Seed the map from a snapshot written by a previous instance, so that
+ * channels that are still being handled are recognised immediately,
+ * rather than once every Handler has told us about its HandledChannels.
+ * Each handler's unique name is watched as usual, so the entries of
+ * handlers that have exited in the meantime (including our own previous
+ * instance, if it was handling channels internally) are discarded as soon
+ * as the bus daemon tells us so; entries that a live handler no longer
+ * lists in its HandledChannels are discarded by
+ * _mcd_handler_map_forget_unlisted().
+ *
+ * That leaves entries whose handler is still running but never tells us
+ * its HandledChannels, for instance because it's not a Client at all.
+ * If we haven't seen those channels on a connection within
+ * SNAPSHOT_CONFIRM_TIMEOUT_MS, they are discarded too.
+ */
+static void
+snapshot_load (McdHandlerMap *self)
+{
+    gchar *contents = NULL;
+    gchar **lines;
+    gchar **line;
+    GError *error = NULL;
+    guint n = 0;
+
+    if (!g_file_get_contents (self->priv->snapshot_path, &contents, NULL,
+                              &error))
+    {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            DEBUG ("Unable to load handled channels: %s", error->message);
+
+        g_error_free (error);
+        return;
+    }
+
+    lines = g_strsplit (contents, "\n", 0);
+    g_free (contents);
+
+    for (line = lines; *line != NULL; line++)
+    {
+        gchar **fields = g_strsplit (*line, "\t", 4);
+        HandledChannel *hc;
+
+        if (g_strv_length (fields) != 4 ||
+            !tp_dbus_check_valid_object_path (fields[0], NULL) ||
+            !tp_dbus_check_valid_bus_name (fields[1],
+                TP_DBUS_NAME_TYPE_UNIQUE, NULL) ||
+            (fields[2][0] != '\0' &&
+             !tp_dbus_check_valid_bus_name (fields[2],
+                 TP_DBUS_NAME_TYPE_WELL_KNOWN, NULL)) ||
+            (fields[3][0] != '\0' &&
+             !tp_dbus_check_valid_object_path (fields[3], NULL)))
+        {
+            if ((*line)[0] != '\0')
+                DEBUG ("Ignoring malformed line in %s",
+                       self->priv->snapshot_path);
+
+            g_strfreev (fields);
+            continue;
+        }
+
+        hc = ensure_handled_channel (self, fields[0]);
+        hc->well_known_name =
+            g_intern_string (fields[2][0] == '\0' ? NULL : fields[2]);
+        hc->account_path =
+            g_intern_string (fields[3][0] == '\0' ? NULL : fields[3]);
+
+        if (hc->handler == NULL)
+        {
+            handled_channel_attach (self, hc, fields[1]);
+            hc->from_snapshot = TRUE;
+        }
+
+        n++;
+        g_strfreev (fields);
+    }
+
+    g_strfreev (lines);
+    DEBUG ("%u handled channels restored from %s", n,
+           self->priv->snapshot_path);
+
+    if (n > 0)
+        self->priv->snapshot_expiry_id = g_timeout_add (get_confirm_timeout (),
+            snapshot_expire_cb, self);
+}
+
 /*
  * @well_known_name: (out): the well-known Client name of the handler,
  *  or %NULL if not known (or if it's Mission Control itself)
@@ -215,11 +720,16 @@ _mcd_handler_map_get_handler (McdHandlerMap *self,
                               const gchar *channel_path,
                               const gchar **well_known_name)
 {
+    HandledChannel *hc = g_hash_table_lookup (self->priv->channels,
+                                              channel_path);
+
     if (well_known_name != NULL)
-        *well_known_name = g_hash_table_lookup (self->priv->channel_clients,
-                                                channel_path);
+        *well_known_name = (hc == NULL ? NULL : hc->well_known_name);
 
-    return g_hash_table_lookup (self->priv->channel_processes, channel_path);
+    if (hc == NULL || hc->handler == NULL)
+        return NULL;
+
+    return hc->handler->unique_name;
 }
 
 /*
@@ -239,60 +749,70 @@ _mcd_handler_map_set_path_handled (McdHandlerMap *self,
                                    const gchar *unique_name,
                                    const gchar *well_known_name)
 {
-    const gchar *old;
-    gsize *counter;
+    HandledChannel *hc = ensure_handled_channel (self, channel_path);
 
     /* In case we want to re-invoke the same client later, remember its
      * well-known name, if we know it. (In edge cases where we're recovering
      * from an MC crash, we can only guess, so we get NULL.) */
-    if (well_known_name == NULL)
-        g_hash_table_remove (self->priv->channel_clients, channel_path);
-    else
-        g_hash_table_insert (self->priv->channel_clients,
-                             g_strdup (channel_path),
-                             g_strdup (well_known_name));
-
-    old = g_hash_table_lookup (self->priv->channel_processes, channel_path);
+    hc->well_known_name = g_intern_string (well_known_name);
+    snapshot_schedule (self);
 
-    if (!tp_strdiff (old, unique_name))
+    if (hc->handler != NULL &&
+        !tp_strdiff (hc->handler->unique_name, unique_name))
     {
         /* no-op - the new handler is the same as the old */
         return;
     }
 
-    if (old != NULL)
+    hc->from_snapshot = FALSE;
+    handled_channel_detach (self, hc);
+    handled_channel_attach (self, hc, unique_name);
+}
+
+/*
+ * @unique_name: the unique name of a handler
+ * @listed: the handler's HandledChannels
+ *
+ * Forget channels that we only attributed to @unique_name because of the
+ * snapshot written by a previous instance, if the handler itself no longer
+ * lists them, for instance because they closed while we were not running.
+ */
+void
+_mcd_handler_map_forget_unlisted (McdHandlerMap *self,
+                                  const gchar *unique_name,
+                                  const GPtrArray *listed)
+{
+    HandlerProcess *hp = g_hash_table_lookup (self->priv->handlers,
+                                              unique_name);
+    GList *stale = NULL;
+    GList *iter;
+    guint i;
+
+    if (hp == NULL)
+        return;
+
+    for (iter = hp->channels.head; iter != NULL; iter = iter->next)
     {
-        counter = g_hash_table_lookup (self->priv->handler_processes,
-                                       old);
+        HandledChannel *hc = iter->data;
+
+        if (!hc->from_snapshot)
+            continue;
 
-        if (--*counter == 0)
+        for (i = 0; i < listed->len; i++)
         {
-            tp_dbus_daemon_cancel_name_owner_watch (self->priv->dbus_daemon,
-                old, mcd_handler_map_name_owner_cb, self);
-            g_hash_table_remove (self->priv->handler_processes, old);
+            if (!tp_strdiff (g_ptr_array_index (listed, i), hc->object_path))
+                break;
         }
-    }
 
-    g_hash_table_insert (self->priv->channel_processes,
-                         g_strdup (channel_path), g_strdup (unique_name));
-
-    counter = g_hash_table_lookup (self->priv->handler_processes,
-                                   unique_name);
-
-    if (counter == NULL)
-    {
-        counter = g_slice_new (gsize);
-        *counter = 1;
-        g_hash_table_insert (self->priv->handler_processes,
-                             g_strdup (unique_name), counter);
-        tp_dbus_daemon_watch_name_owner (self->priv->dbus_daemon, unique_name,
-                                         mcd_handler_map_name_owner_cb, self,
-                                         NULL);
-    }
-    else
-    {
-        ++*counter;
+        if (i < listed->len)
+            hc->from_snapshot = FALSE;
+        else
+            stale = g_list_prepend (stale, hc);
     }
+
+    /* this may free hp */
+    forget_stale (self, stale);
+    g_list_free (stale);
 }
 
 static void
@@ -304,32 +824,24 @@ handled_channel_invalidated_cb (TpChannel *channel,
 {
     McdHandlerMap *self = MCD_HANDLER_MAP (user_data);
     const gchar *path = tp_proxy_get_object_path (channel);
-    gchar *handler;
+    HandledChannel *hc;
 
     g_signal_handlers_disconnect_by_func (channel,
                                           handled_channel_invalidated_cb,
                                           user_data);
 
-    handler = g_hash_table_lookup (self->priv->channel_processes, path);
+    /* NULL if we have already been disposed */
+    hc = (self->priv->channels == NULL ? NULL :
+          g_hash_table_lookup (self->priv->channels, path));
 
-    if (handler != NULL)
+    if (hc != NULL)
     {
-        gsize *counter = g_hash_table_lookup (self->priv->handler_processes,
-                                              handler);
-
-        g_assert (counter != NULL);
-
-        if (--*counter == 0)
-        {
-            g_hash_table_remove (self->priv->handler_processes, handler);
-        }
-
-        g_hash_table_remove (self->priv->channel_processes, path);
+        handled_channel_detach (self, hc);
+        handled_channel_set_channel (self, hc, NULL);
+        g_hash_table_remove (self->priv->channels, path);
+        snapshot_schedule (self);
     }
 
-    g_hash_table_remove (self->priv->handled_channels, path);
-    g_hash_table_remove (self->priv->channel_accounts, path);
-
     g_object_unref (self);
 }
 
@@ -354,18 +866,24 @@ _mcd_handler_map_set_channel_handled (McdHandlerMap *self,
                                       const gchar *account_path)
 {
     const gchar *path = tp_proxy_get_object_path (channel);
+    HandledChannel *hc = ensure_handled_channel (self, path);
 
-    g_hash_table_insert (self->priv->handled_channels,
-                         g_strdup (path),
-                         g_object_ref (channel));
+    hc->account_path = g_intern_string (account_path);
 
-    g_hash_table_insert (self->priv->channel_accounts,
-                         g_strdup (path),
-                         g_strdup (account_path));
+    if (hc->channel != channel)
+    {
+        if (hc->channel != NULL)
+        {
+            g_signal_handlers_disconnect_by_func (hc->channel,
+                handled_channel_invalidated_cb, self);
+            g_object_unref (self);
+        }
 
-    g_signal_connect (channel, "invalidated",
-                      G_CALLBACK (handled_channel_invalidated_cb),
-                      g_object_ref (self));
+        handled_channel_set_channel (self, hc, channel);
+        g_signal_connect (channel, "invalidated",
+                          G_CALLBACK (handled_channel_invalidated_cb),
+                          g_object_ref (self));
+    }
 
     _mcd_handler_map_set_path_handled (self, path, unique_name,
                                        well_known_name);
@@ -375,55 +893,50 @@ static void
 _mcd_handler_map_set_handler_crashed (McdHandlerMap *self,
                                       const gchar *unique_name)
 {
-    gsize *counter = g_hash_table_lookup (self->priv->handler_processes,
-                                          unique_name);
+    HandlerProcess *hp = g_hash_table_lookup (self->priv->handlers,
+                                              unique_name);
+    GList *channels = NULL;
 
-    if (counter != NULL)
+    if (hp == NULL)
+        return;
+
+    snapshot_schedule (self);
+
+    /* Only this handler's channels are visited. Detaching the last one
+     * cancels the name-owner watch and frees hp. */
+    while (hp != NULL)
     {
-        GHashTableIter iter;
-        gpointer path_p, name_p;
-        GList *paths = NULL;
+        HandledChannel *hc = g_queue_peek_head (&hp->channels);
 
-        tp_dbus_daemon_cancel_name_owner_watch (self->priv->dbus_daemon,
-                                                unique_name,
-                                                mcd_handler_map_name_owner_cb,
-                                                self);
-        g_hash_table_remove (self->priv->handler_processes, unique_name);
+        if (g_queue_get_length (&hp->channels) == 1)
+            hp = NULL;
 
-        /* This is O(number of channels being handled) but then again
-         * it only happens if a handler crashes */
-        g_hash_table_iter_init (&iter, self->priv->channel_processes);
+        DEBUG ("%s lost its handler %s", hc->object_path, unique_name);
 
-        while (g_hash_table_iter_next (&iter, &path_p, &name_p))
-        {
-            if (!tp_strdiff (name_p, unique_name))
-            {
-                DEBUG ("%s lost its handler %s", (const gchar *) path_p,
-                       (const gchar *) name_p);
-                paths = g_list_prepend (paths, g_strdup (path_p));
-                g_hash_table_iter_remove (&iter);
-            }
-        }
+        handled_channel_detach (self, hc);
+
+        /* if all we knew was its path, there's nothing left to remember */
+        if (hc->channel == NULL)
+            g_hash_table_remove (self->priv->channels, hc->object_path);
+        else
+            channels = g_list_prepend (channels, g_object_ref (hc->channel));
+    }
 
-        while (paths != NULL)
+    while (channels != NULL)
+    {
+        TpChannel *channel = channels->data;
+
+        if (_mcd_tp_channel_should_close (channel, "closing"))
         {
-            gchar *path = paths->data;
-            TpChannel *channel = g_hash_table_lookup (
-                self->priv->handled_channels, path);
-
-            /* this is NULL-safe */
-            if (_mcd_tp_channel_should_close (channel, "closing"))
-            {
-                DEBUG ("Closing channel %s", path);
-                /* the corresponding McdChannel will get aborted when the
-                 * Channel actually closes */
-                tp_cli_channel_call_close (channel, -1,
-                                           NULL, NULL, NULL, NULL);
-            }
-
-            paths = g_list_delete_link (paths, paths);
-            g_free (path);
+            DEBUG ("Closing channel %s", tp_proxy_get_object_path (channel));
+            /* the corresponding McdChannel will get aborted when the
+             * Channel actually closes */
+            tp_cli_channel_call_close (channel, -1,
+                                       NULL, NULL, NULL, NULL);
         }
+
+        channels = g_list_delete_link (channels, channels);
+        g_object_unref (channel);
     }
 }
 
@@ -445,7 +958,48 @@ mcd_handler_map_name_owner_cb (TpDBusDaemon *dbus_daemon,
 GList *
 _mcd_handler_map_get_handled_channels (McdHandlerMap *self)
 {
-    return g_hash_table_get_values (self->priv->handled_channels);
+    GHashTableIter iter;
+    gpointer v;
+    GList *ret = NULL;
+
+    g_hash_table_iter_init (&iter, self->priv->channels);
+
+    while (g_hash_table_iter_next (&iter, NULL, &v))
+    {
+        HandledChannel *hc = v;
+
+        if (hc->channel != NULL)
+            ret = g_list_prepend (ret, hc->channel);
+    }
+
+    return ret;
+}
+
+/*
+ * @channel_type: a channel type
+ *
+ * Returns: (transfer container): all channels of type @channel_type that
+ *  are being handled
+ */
+GList *
+_mcd_handler_map_get_handled_channels_of_type (McdHandlerMap *self,
+                                               const gchar *channel_type)
+{
+    GQueue *queue = g_hash_table_lookup (self->priv->by_type, channel_type);
+    GList *ret = NULL;
+    GList *link;
+
+    if (queue == NULL)
+        return NULL;
+
+    for (link = queue->head; link != NULL; link = link->next)
+    {
+        HandledChannel *hc = link->data;
+
+        ret = g_list_prepend (ret, hc->channel);
+    }
+
+    return ret;
 }
 
 /*
@@ -456,8 +1010,13 @@ const gchar *
 _mcd_handler_map_get_channel_account (McdHandlerMap *self,
     const gchar *channel_path)
 {
-    return g_hash_table_lookup (self->priv->channel_accounts,
-        channel_path);
+    HandledChannel *hc = g_hash_table_lookup (self->priv->channels,
+                                              channel_path);
+
+    if (hc == NULL)
+        return NULL;
+
+    return hc->account_path;
 }
 
 /*
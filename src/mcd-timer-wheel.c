@@ -0,0 +1,426 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * A timer wheel shared by many low-precision timeouts.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "config.h"
+
+#include "mcd-timer-wheel.h"
+
+#include "mcd-debug.h"
+
+/*
+ * Rather than having a GSource per timeout, timeouts that don't need to be
+ * precise (reconnection, probation, batching of property changes) are kept
+ * in a hierarchical timer wheel, and a single GSource wakes up the main loop
+ * when the earliest of them is due.
+ *
+ * Time is measured in ticks of TICK_MS since the wheel was first used.
+ * Level 0 has a slot for each of the next N_SLOTS ticks; each slot in
+ * level L covers N_SLOTS times as many ticks as a slot in level L-1. When
+ * the wheel reaches the start of a level L slot, its timers are
+ * redistributed ("cascaded") into the lower levels.
+ *
+ * Each timeout may fire up to its slack later than requested. The actual
+ * expiry tick is rounded down to the largest power of two that the slack
+ * allows, so that timeouts added at slightly different times tend to share
+ * a tick, and hence a wakeup.
+ */
+#define TICK_MS 10
+#define SLOT_BITS 6
+#define N_SLOTS (1 << SLOT_BITS)
+#define SLOT_MASK (N_SLOTS - 1)
+#define N_LEVELS 4
+/* timeouts further away than this are cascaded early and re-filed */
+#define MAX_DELTA (((guint64) 1 << (SLOT_BITS * N_LEVELS)) - 1)
+
+typedef struct {
+    guint id;
+    guint delay_ms;
+    guint slack_ms;
+    GSourceFunc function;
+    gpointer data;
+    GDestroyNotify notify;
+    guint64 expires;
+    /* the slot we're in, or NULL while being dispatched */
+    GQueue *slot;
+    GList link;
+    /* removed while being dispatched */
+    gboolean cancelled;
+} Timer;
+
+static GQueue wheel[N_LEVELS][N_SLOTS];
+/* guint id => owned Timer */
+static GHashTable *timers = NULL;
+static guint next_id = 1;
+/* monotonic time of tick 0, in microseconds */
+static gint64 base_us = 0;
+/* the last tick we have processed */
+static guint64 current = 0;
+static GSource *source = NULL;
+/* the tick at which source is due to dispatch, or G_MAXUINT64 */
+static guint64 armed = G_MAXUINT64;
+
+static guint64
+now_ticks (void)
+{
+    return (g_get_monotonic_time () - base_us) / (TICK_MS * 1000);
+}
+
+static guint64
+ms_to_ticks_ceil (gint64 ms)
+{
+    return (ms + TICK_MS - 1) / TICK_MS;
+}
+
+/* the tick at which a timer in @level due at @expires must be looked at */
+static guint64
+event_tick (guint level,
+            guint64 expires)
+{
+    return (expires >> (SLOT_BITS * level)) << (SLOT_BITS * level);
+}
+
+static void
+arm (guint64 tick)
+{
+    armed = tick;
+
+    if (tick == G_MAXUINT64)
+        g_source_set_ready_time (source, -1);
+    else
+        g_source_set_ready_time (source,
+                                 base_us + (gint64) tick * TICK_MS * 1000);
+}
+
+/* @earliest is the first tick whose slot will still be looked at: normally
+ * current + 1, but a timer cascaded during run_tick() can still make it into
+ * the current tick */
+static void
+file_timer (Timer *timer,
+            guint64 earliest)
+{
+    guint64 expires = MAX (timer->expires, earliest);
+    guint64 delta = expires - current;
+    guint level;
+
+    if (delta > MAX_DELTA)
+    {
+        expires = current + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    for (level = 0; level < N_LEVELS - 1; level++)
+    {
+        if (delta < ((guint64) 1 << (SLOT_BITS * (level + 1))))
+            break;
+    }
+
+    timer->slot =
+        &wheel[level][(expires >> (SLOT_BITS * level)) & SLOT_MASK];
+    g_queue_push_tail_link (timer->slot, &timer->link);
+
+    if (event_tick (level, expires) < armed)
+        arm (MAX (event_tick (level, expires), current + 1));
+}
+
+static void
+schedule_timer (Timer *timer)
+{
+    gint64 now_ms = (g_get_monotonic_time () - base_us) / 1000;
+    guint64 earliest = ms_to_ticks_ceil (now_ms + timer->delay_ms);
+    guint64 latest = (now_ms + timer->delay_ms + timer->slack_ms) / TICK_MS;
+
+    timer->expires = earliest;
+
+    if (latest > earliest)
+    {
+        guint64 room = latest - earliest + 1;
+        guint64 align = 1;
+
+        while (align * 2 <= room)
+            align *= 2;
+
+        timer->expires = latest & ~(align - 1);
+    }
+
+    file_timer (timer, current + 1);
+}
+
+/* the next tick at which a timer is due, or has to be cascaded */
+static guint64
+next_event (void)
+{
+    guint64 best = G_MAXUINT64;
+    guint level;
+
+    for (level = 0; level < N_LEVELS; level++)
+    {
+        guint shift = SLOT_BITS * level;
+        guint64 block = current >> shift;
+        guint k;
+
+        for (k = 1; k <= N_SLOTS; k++)
+        {
+            if (!g_queue_is_empty (&wheel[level][(block + k) & SLOT_MASK]))
+            {
+                best = MIN (best, (block + k) << shift);
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+static void
+destroy_timer (Timer *timer)
+{
+    if (timer->notify != NULL)
+        timer->notify (timer->data);
+
+    g_slice_free (Timer, timer);
+}
+
+static void
+cascade (guint level,
+         guint64 tick)
+{
+    GQueue *slot = &wheel[level][(tick >> (SLOT_BITS * level)) & SLOT_MASK];
+    GQueue pending = *slot;
+    GList *link;
+
+    /* take the whole slot first, since re-filing might put a timer back
+     * into this slot if it's too far away */
+    g_queue_init (slot);
+
+    /* timers due at @tick itself go into level 0's slot for @tick, which
+     * run_tick() empties after cascading */
+    while ((link = g_queue_pop_head_link (&pending)) != NULL)
+        file_timer (link->data, tick);
+}
+
+static void
+run_tick (guint64 tick)
+{
+    GQueue *slot = &wheel[0][tick & SLOT_MASK];
+    GList *link;
+    guint level;
+
+    for (level = 1; level < N_LEVELS; level++)
+    {
+        if ((tick & (((guint64) 1 << (SLOT_BITS * level)) - 1)) != 0)
+            break;
+
+        cascade (level, tick);
+    }
+
+    while ((link = g_queue_pop_head_link (slot)) != NULL)
+    {
+        Timer *timer = link->data;
+        gboolean again;
+
+        timer->slot = NULL;
+        again = timer->function (timer->data);
+
+        if (again && !timer->cancelled)
+        {
+            schedule_timer (timer);
+        }
+        else
+        {
+            if (!timer->cancelled)
+                g_hash_table_remove (timers, GUINT_TO_POINTER (timer->id));
+
+            destroy_timer (timer);
+        }
+    }
+}
+
+/* run every timer that is due up to and including tick @now */
+static void
+advance (guint64 now)
+{
+    while (current < now)
+    {
+        guint64 next = next_event ();
+
+        if (next > now)
+        {
+            current = now;
+            break;
+        }
+
+        current = next;
+        run_tick (current);
+    }
+}
+
+static gboolean
+wheel_dispatch (GSource *s G_GNUC_UNUSED,
+                GSourceFunc callback G_GNUC_UNUSED,
+                gpointer user_data G_GNUC_UNUSED)
+{
+    armed = G_MAXUINT64;
+    advance (now_ticks ());
+    arm (next_event ());
+    return TRUE;
+}
+
+static GSourceFuncs wheel_funcs = {
+    NULL,
+    NULL,
+    wheel_dispatch,
+    NULL,
+};
+
+static void
+ensure_wheel (void)
+{
+    guint level, i;
+
+    if (G_LIKELY (source != NULL))
+        return;
+
+    for (level = 0; level < N_LEVELS; level++)
+    {
+        for (i = 0; i < N_SLOTS; i++)
+            g_queue_init (&wheel[level][i]);
+    }
+
+    timers = g_hash_table_new (NULL, NULL);
+    base_us = g_get_monotonic_time ();
+    current = 0;
+
+    source = g_source_new (&wheel_funcs, sizeof (GSource));
+    g_source_set_name (source, "McdTimerWheel");
+    g_source_attach (source, NULL);
+}
+
+/*
+ * _mcd_timer_wheel_add_full:
+ * @delay_ms: how long to wait before calling @function
+ * @slack_ms: how much longer than @delay_ms we may wait, so that timeouts
+ *  can be dispatched together
+ * @function: called with @data when the timeout expires; if it returns
+ *  %TRUE, it will be called again after another @delay_ms
+ * @data: data for @function
+ * @notify: called on @data when the timeout is removed, or %NULL
+ *
+ * Like g_timeout_add_full(), but without needing a GSource per timeout.
+ * Timeouts are only accurate to within 10ms or so, plus @slack_ms.
+ *
+ * Returns: a non-zero ID for _mcd_timer_wheel_remove()
+ */
+guint
+_mcd_timer_wheel_add_full (guint delay_ms,
+                           guint slack_ms,
+                           GSourceFunc function,
+                           gpointer data,
+                           GDestroyNotify notify)
+{
+    Timer *timer;
+    guint64 now;
+
+    g_return_val_if_fail (function != NULL, 0);
+
+    ensure_wheel ();
+
+    /* if nothing is due yet, catch up with the clock so that the new
+     * timeout goes into the most precise level possible */
+    now = now_ticks ();
+
+    if (now > current && next_event () > now)
+        current = now;
+
+    timer = g_slice_new0 (Timer);
+    timer->delay_ms = delay_ms;
+    timer->slack_ms = slack_ms;
+    timer->function = function;
+    timer->data = data;
+    timer->notify = notify;
+    timer->link.data = timer;
+
+    /* skip 0 if we wrap around */
+    do
+        timer->id = next_id++;
+    while (timer->id == 0 ||
+           g_hash_table_contains (timers, GUINT_TO_POINTER (timer->id)));
+
+    g_hash_table_insert (timers, GUINT_TO_POINTER (timer->id), timer);
+    schedule_timer (timer);
+
+    return timer->id;
+}
+
+guint
+_mcd_timer_wheel_add (guint delay_ms,
+                      guint slack_ms,
+                      GSourceFunc function,
+                      gpointer data)
+{
+    return _mcd_timer_wheel_add_full (delay_ms, slack_ms, function, data,
+                                      NULL);
+}
+
+/*
+ * _mcd_timer_wheel_remove:
+ * @id: an ID returned by _mcd_timer_wheel_add() or
+ *  _mcd_timer_wheel_add_full()
+ *
+ * Cancel a timeout. It's OK to do this from the timeout's own callback.
+ *
+ * Returns: %TRUE if the timeout was found
+ */
+gboolean
+_mcd_timer_wheel_remove (guint id)
+{
+    Timer *timer;
+
+    if (timers == NULL)
+        return FALSE;
+
+    timer = g_hash_table_lookup (timers, GUINT_TO_POINTER (id));
+
+    if (timer == NULL)
+    {
+        WARNING ("no timeout with ID %u", id);
+        return FALSE;
+    }
+
+    g_hash_table_remove (timers, GUINT_TO_POINTER (id));
+
+    if (timer->slot == NULL)
+    {
+        /* it's being dispatched: run_tick() will free it */
+        timer->cancelled = TRUE;
+    }
+    else
+    {
+        g_queue_unlink (timer->slot, &timer->link);
+        destroy_timer (timer);
+    }
+
+    /* if that was the earliest timeout, the source will wake up for
+     * nothing, which is harmless */
+    return TRUE;
+}
@@ -0,0 +1,41 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * A timer wheel shared by many low-precision timeouts.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef MCD_TIMER_WHEEL_H_
+#define MCD_TIMER_WHEEL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL guint _mcd_timer_wheel_add (guint delay_ms, guint slack_ms,
+    GSourceFunc function, gpointer data);
+G_GNUC_INTERNAL guint _mcd_timer_wheel_add_full (guint delay_ms,
+    guint slack_ms, GSourceFunc function, gpointer data,
+    GDestroyNotify notify);
+G_GNUC_INTERNAL gboolean _mcd_timer_wheel_remove (guint id);
+
+G_END_DECLS
+
+#endif
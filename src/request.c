@@ -31,6 +31,7 @@
 #include "mcd-account-priv.h"
 #include "mcd-connection-priv.h"
 #include "mcd-debug.h"
+#include "mcd-dispatch-stats.h"
 #include "mcd-misc.h"
 #include "plugin-loader.h"
 #include "plugin-request.h"
@@ -79,6 +80,12 @@ struct _McdRequest {
     gsize delay;
     TpClient *predicted_handler;
 
+    /* TRUE if the request is for an emergency service point. Urgent
+     * requests skip policy plugins and account locks, and are handled by
+     * resolved_handler if the requester didn't have a preference. */
+    gboolean urgent;
+    gchar *resolved_handler;
+
     /* TRUE if either succeeded[-with-channel] or failed was emitted */
     gboolean is_complete;
 
@@ -88,6 +95,9 @@ struct _McdRequest {
     gchar *failure_message;
 
     gboolean proceeding;
+
+    /* when each stage of the request was reached, from Proceed() on */
+    McdDispatchTimeline timeline;
 };
 
 struct _McdRequestClass {
@@ -96,6 +106,7 @@ struct _McdRequestClass {
 };
 
 static void request_iface_init (TpSvcChannelRequestClass *);
+static void mcd_request_preactivate_handler (McdRequest *self);
 
 G_DEFINE_TYPE_WITH_CODE (McdRequest, _mcd_request, G_TYPE_OBJECT,
     G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_REQUEST, request_iface_init);
@@ -116,6 +127,27 @@ _mcd_request_init (McdRequest *self)
   self->object_path = g_strdup_printf (REQUEST_OBJ_BASE "%u", last_req_id++);
 }
 
+/* Returns: TRUE if the request's target is one of the emergency service
+ * points that the account's connection knows about */
+static gboolean
+mcd_request_check_urgent (McdRequest *self)
+{
+  McdConnection *connection = mcd_account_get_connection (self->account);
+  const gchar *name;
+
+  if (connection == NULL || self->properties == NULL)
+    return FALSE;
+
+  name = tp_asv_get_string (self->properties, TP_PROP_CHANNEL_TARGET_ID);
+
+  if (name != NULL)
+    return _mcd_connection_target_id_is_urgent (connection, name);
+
+  return _mcd_connection_target_handle_is_urgent (connection,
+      tp_asv_get_uint32 (self->properties, TP_PROP_CHANNEL_TARGET_HANDLE,
+          NULL));
+}
+
 static void
 _mcd_request_constructed (GObject *object)
 {
@@ -133,6 +165,7 @@ _mcd_request_constructed (GObject *object)
   g_return_if_fail (self->clients != NULL);
 
   self->dbus_daemon = _mcd_client_registry_get_dbus_daemon (self->clients);
+  self->urgent = mcd_request_check_urgent (self);
   tp_dbus_daemon_register_object (self->dbus_daemon, self->object_path, self);
 }
 
@@ -303,6 +336,7 @@ _mcd_request_finalize (GObject *object)
   _mcd_request_clear_internal_handler (self);
 
   g_free (self->preferred_handler);
+  g_free (self->resolved_handler);
   g_free (self->object_path);
   g_free (self->failure_message);
   tp_clear_pointer (&self->properties, g_hash_table_unref);
@@ -514,6 +548,33 @@ _mcd_request_get_preferred_handler (McdRequest *self)
   return self->preferred_handler;
 }
 
+/*
+ * _mcd_request_get_handler_hint:
+ * @self: a request
+ *
+ * Returns: the well-known name of the handler we should try first for the
+ *  channel satisfying @self: the preferred handler if there was one, or for
+ *  urgent requests, the handler chosen when the request was made;
+ *  or "" if no handler was suggested
+ */
+const gchar *
+_mcd_request_get_handler_hint (McdRequest *self)
+{
+  if (!tp_str_empty (self->preferred_handler))
+    return self->preferred_handler;
+
+  if (self->resolved_handler != NULL)
+    return self->resolved_handler;
+
+  return "";
+}
+
+gboolean
+_mcd_request_is_urgent (McdRequest *self)
+{
+  return self->urgent;
+}
+
 const gchar *
 _mcd_request_get_object_path (McdRequest *self)
 {
@@ -679,9 +740,7 @@ void
 _mcd_request_proceed (McdRequest *self,
     DBusGMethodInvocation *context)
 {
-  McdConnection *connection = NULL;
   McdPluginRequest *plugin_api = NULL;
-  gboolean urgent = FALSE;
   gboolean blocked = FALSE;
   const GList *mini_plugins;
 
@@ -697,33 +756,24 @@ _mcd_request_proceed (McdRequest *self,
     }
 
   self->proceeding = TRUE;
+  /* the time the client takes to call Proceed() is not ours */
+  _mcd_dispatch_timeline_init (&self->timeline);
 
   tp_clear_pointer (&context, tp_svc_channel_request_return_from_proceed);
 
-  connection = mcd_account_get_connection (self->account);
-
-  if (connection != NULL)
-    {
-      const gchar *name =
-        tp_asv_get_string (self->properties, TP_PROP_CHANNEL_TARGET_ID);
-
-      if (name != NULL)
-        {
-          urgent = _mcd_connection_target_id_is_urgent (connection, name);
-        }
-      else
-        {
-          guint handle = tp_asv_get_uint32 (self->properties,
-              TP_PROP_CHANNEL_TARGET_HANDLE, NULL);
-
-          urgent = _mcd_connection_target_handle_is_urgent (connection, handle);
-        }
-    }
+  /* the connection might have found out about its service points since the
+   * request was made */
+  if (!self->urgent)
+    self->urgent = mcd_request_check_urgent (self);
 
   /* urgent calls (eg emergency numbers) are not subject to policy *
    * delays: they automatically pass go and collect 200 qwatloos   */
-  if (urgent)
-    goto proceed;
+  if (self->urgent)
+    {
+      DEBUG ("%s is urgent, skipping policy and account locks",
+          self->object_path);
+      goto proceed;
+    }
 
   /* requests can pick up an extra delay (and ref) here */
   blocked = _queue_blocked_requests (self);
@@ -788,6 +838,9 @@ _mcd_request_end_delay (McdRequest *self)
 
     if (--self->delay == 0)
     {
+      _mcd_dispatch_timeline_mark (&self->timeline,
+          MCD_DISPATCH_STAGE_REQUEST_POLICY);
+      mcd_request_preactivate_handler (self);
       g_signal_emit (self, sig_id_ready_to_request, 0);
     }
 
@@ -817,6 +870,8 @@ _mcd_request_set_success (McdRequest *self,
       GValue value = G_VALUE_INIT;
 
       DEBUG ("Request succeeded");
+      _mcd_dispatch_timeline_mark (&self->timeline,
+          MCD_DISPATCH_STAGE_REQUEST_CHANNEL);
       self->is_complete = TRUE;
       self->cancellable = FALSE;
 
@@ -997,7 +1052,8 @@ guess_request_handler (McdRequest *self)
 
   properties = mcd_request_dup_properties (self);
   sorted_handlers = _mcd_client_registry_list_possible_handlers (
-      self->clients, self->preferred_handler, properties,
+      self->clients, self->preferred_handler,
+      mcd_account_get_object_path (self->account), properties,
       NULL, NULL);
   g_variant_unref (properties);
 
@@ -1012,6 +1068,80 @@ guess_request_handler (McdRequest *self)
   return NULL;
 }
 
+/*
+ * mcd_request_get_preactivate_handlers:
+ *
+ * Returns: %TRUE unless MC_PREACTIVATE_HANDLERS=0 is set in the
+ *  environment
+ */
+static gboolean
+mcd_request_get_preactivate_handlers (void)
+{
+  static gint preactivate = -1;
+
+  if (G_UNLIKELY (preactivate < 0))
+    {
+      const gchar *value = g_getenv ("MC_PREACTIVATE_HANDLERS");
+
+      preactivate = (value == NULL || tp_strdiff (value, "0"));
+    }
+
+  return preactivate;
+}
+
+static void
+mcd_request_start_service_cb (TpDBusDaemon *proxy,
+    guint result,
+    const GError *error,
+    gpointer user_data,
+    GObject *weak_object G_GNUC_UNUSED)
+{
+  const gchar *name = user_data;
+
+  /* if this fails, HandleChannels will try (and fail) again later, and
+   * that's where we deal with it */
+  if (error != NULL)
+    DEBUG ("Failed to start %s early: %s", name, error->message);
+  else
+    DEBUG ("Started %s early (result %u)", name, result);
+}
+
+/*
+ * mcd_request_preactivate_handler:
+ *
+ * If the Handler we expect to get this request's channel is activatable but
+ * not running, ask the bus daemon to start it now, so that it starts up
+ * while the connection is creating the channel rather than afterwards.
+ *
+ * This is only done once policy has let the request go ahead, and never for
+ * requests that MC handles itself.
+ */
+static void
+mcd_request_preactivate_handler (McdRequest *self)
+{
+  McdClientProxy *handler;
+  const gchar *name;
+
+  if (!mcd_request_get_preactivate_handlers () ||
+      self->internal_handler != NULL ||
+      self->is_complete)
+    return;
+
+  handler = (McdClientProxy *) guess_request_handler (self);
+
+  if (handler == NULL ||
+      !_mcd_client_proxy_is_activatable (handler) ||
+      _mcd_client_proxy_is_active (handler))
+    return;
+
+  name = tp_proxy_get_bus_name (handler);
+  DEBUG ("Starting %s for request %s", name, self->object_path);
+
+  tp_cli_dbus_daemon_call_start_service_by_name (
+      _mcd_client_registry_get_dbus_daemon (self->clients), -1, name, 0,
+      mcd_request_start_service_cb, g_strdup (name), g_free, NULL);
+}
+
 void
 _mcd_request_predict_handler (McdRequest *self)
 {
@@ -1032,6 +1162,17 @@ _mcd_request_predict_handler (McdRequest *self)
       return;
     }
 
+  /* For an urgent request, don't make the dispatcher think about it again
+   * when the channel appears: use the handler we guessed now */
+  if (self->urgent && tp_str_empty (self->preferred_handler))
+    {
+      DEBUG ("Urgent request %s will go to %s", self->object_path,
+          tp_proxy_get_bus_name (predicted_handler));
+      g_free (self->resolved_handler);
+      self->resolved_handler = g_strdup (
+          tp_proxy_get_bus_name (predicted_handler));
+    }
+
   if (!tp_proxy_has_interface_by_id (predicted_handler,
       TP_IFACE_QUARK_CLIENT_INTERFACE_REQUESTS))
     {
@@ -67,6 +67,9 @@ G_GNUC_INTERNAL GVariant *mcd_request_dup_properties (McdRequest *self);
 G_GNUC_INTERNAL gint64 _mcd_request_get_user_action_time (McdRequest *self);
 G_GNUC_INTERNAL const gchar *_mcd_request_get_preferred_handler (
     McdRequest *self);
+G_GNUC_INTERNAL const gchar *_mcd_request_get_handler_hint (
+    McdRequest *self);
+G_GNUC_INTERNAL gboolean _mcd_request_is_urgent (McdRequest *self);
 G_GNUC_INTERNAL const gchar *_mcd_request_get_object_path (McdRequest *self);
 G_GNUC_INTERNAL GHashTable *_mcd_request_get_hints (
     McdRequest *self);
@@ -0,0 +1,364 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Regression test for reading the account connections file
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <config.h>
+
+#include <glib/gstdio.h>
+
+/* Yes, this is a hack */
+#include "mcd-account-manager.c"
+
+#define HEADER_V1 "# Mission Control account connections 1\n"
+#define HEADER_V2 "# Mission Control account connections 2\n"
+
+#define CONN_PATH_PREFIX "/org/freedesktop/Telepathy/Connection/"
+#define CONN_BUS_NAME_PREFIX "org.freedesktop.Telepathy.Connection."
+
+static GHashTable *
+load_from_string (const gchar *contents,
+    gssize len)
+{
+  GError *error = NULL;
+  gchar *dir;
+  gchar *path;
+  GHashTable *ret;
+
+  dir = g_dir_make_tmp ("mc-account-connections-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (dir, "account-connections", NULL);
+
+  g_file_set_contents (path, contents, len, &error);
+  g_assert_no_error (error);
+
+  ret = load_account_connections (path);
+
+  g_unlink (path);
+  g_rmdir (dir);
+  g_free (path);
+  g_free (dir);
+  return ret;
+}
+
+static void
+assert_connection (GHashTable *connections,
+    const gchar *conn,
+    const gchar *account_name)
+{
+  gchar *path = g_strconcat (CONN_PATH_PREFIX, conn, NULL);
+  gchar *bus_name = g_strdelimit (g_strconcat (CONN_BUS_NAME_PREFIX, conn,
+        NULL), "/", '.');
+  AccountConnection *ac = g_hash_table_lookup (connections, path);
+
+  g_assert (ac != NULL);
+  g_assert_cmpstr (ac->bus_name, ==, bus_name);
+  g_assert_cmpstr (ac->account_name, ==, account_name);
+
+  g_free (path);
+  g_free (bus_name);
+}
+
+static void
+append_counted (GString *str,
+    const gchar *s)
+{
+  g_string_append_printf (str, "%u:%s", (guint) strlen (s), s);
+}
+
+/* Append a version 1 record, or a version 2 "+" record if @op is '+' */
+static void
+append_record (GString *str,
+    gchar op,
+    const gchar *conn,
+    const gchar *account_name)
+{
+  gchar *path = g_strconcat (CONN_PATH_PREFIX, conn, NULL);
+  gchar *bus_name = g_strdelimit (g_strconcat (CONN_BUS_NAME_PREFIX, conn,
+        NULL), "/", '.');
+
+  if (op != '\0')
+    g_string_append_c (str, op);
+
+  append_counted (str, path);
+  append_counted (str, bus_name);
+  append_counted (str, account_name);
+  g_string_append_c (str, '\n');
+
+  g_free (path);
+  g_free (bus_name);
+}
+
+/* Append a version 2 "-" record */
+static void
+append_removal (GString *str,
+    const gchar *account_name)
+{
+  g_string_append_c (str, '-');
+  append_counted (str, account_name);
+  g_string_append_c (str, '\n');
+}
+
+static void
+assert_same_connections (GHashTable *expected,
+    GHashTable *actual)
+{
+  GHashTableIter iter;
+  gpointer k, v;
+
+  g_assert_cmpuint (g_hash_table_size (actual), ==,
+      g_hash_table_size (expected));
+
+  g_hash_table_iter_init (&iter, expected);
+
+  while (g_hash_table_iter_next (&iter, &k, &v))
+    {
+      AccountConnection *e = v;
+      AccountConnection *a = g_hash_table_lookup (actual, k);
+
+      g_assert (a != NULL);
+      g_assert_cmpstr (a->bus_name, ==, e->bus_name);
+      g_assert_cmpstr (a->account_name, ==, e->account_name);
+    }
+}
+
+/*
+ * Load every prefix of @str that is at least @header_len long, as if we had
+ * crashed while writing it, and check that we get the same as if it had
+ * stopped after its last complete line.
+ */
+static void
+assert_truncation_ignored (GString *str,
+    gsize header_len)
+{
+  gsize len;
+
+  for (len = header_len; len <= str->len; len++)
+    {
+      GHashTable *connections = load_from_string (str->str, len);
+      GHashTable *expected;
+      gsize complete = len;
+
+      while (complete > header_len && str->str[complete - 1] != '\n')
+        complete--;
+
+      expected = load_from_string (str->str, complete);
+      assert_same_connections (expected, connections);
+      g_hash_table_unref (expected);
+      g_hash_table_unref (connections);
+    }
+}
+
+static void
+test_missing (void)
+{
+  GHashTable *connections;
+
+  connections = load_account_connections ("/nonexistent/account-connections");
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 0);
+  g_hash_table_unref (connections);
+
+  connections = load_from_string ("# Some other format\nblah\n", -1);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 0);
+  g_hash_table_unref (connections);
+}
+
+static void
+test_legacy (void)
+{
+  GHashTable *connections;
+
+  connections = load_from_string (
+      CONN_PATH_PREFIX "gabble/jabber/alice\t"
+      CONN_BUS_NAME_PREFIX "gabble.jabber.alice\t"
+      "gabble/jabber/alice0\n"
+      CONN_PATH_PREFIX "idle/irc/bob\t"
+      CONN_BUS_NAME_PREFIX "idle.irc.bob\t"
+      "idle/irc/bob0\n"
+      CONN_PATH_PREFIX "haze/msn/chris\t"
+      CONN_BUS_NAME_PREFIX "haze.msn.chris\t"
+      "haze/msn/chr", -1);
+
+  /* the last line was cut short */
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 2);
+  assert_connection (connections, "gabble/jabber/alice",
+      "gabble/jabber/alice0");
+  assert_connection (connections, "idle/irc/bob", "idle/irc/bob0");
+  g_hash_table_unref (connections);
+}
+
+static void
+test_v1 (void)
+{
+  GString *str = g_string_new (HEADER_V1);
+  GHashTable *connections;
+
+  append_record (str, '\0', "gabble/jabber/alice", "gabble/jabber/alice0");
+  append_record (str, '\0', "idle/irc/bob", "idle/irc/bob0");
+  /* field contents are not special, even if they would have been in the
+   * tab-separated format */
+  append_record (str, '\0', "haze/msn/chris", "haze/msn/a\tb:3\n");
+
+  connections = load_from_string (str->str, str->len);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 3);
+  assert_connection (connections, "gabble/jabber/alice",
+      "gabble/jabber/alice0");
+  assert_connection (connections, "idle/irc/bob", "idle/irc/bob0");
+  assert_connection (connections, "haze/msn/chris", "haze/msn/a\tb:3\n");
+  g_hash_table_unref (connections);
+
+  g_string_free (str, TRUE);
+}
+
+static void
+test_v1_truncated (void)
+{
+  GString *str = g_string_new (HEADER_V1);
+  GHashTable *connections;
+
+  append_record (str, '\0', "gabble/jabber/alice", "gabble/jabber/alice0");
+  append_record (str, '\0', "idle/irc/bob", "idle/irc/bob0");
+
+  assert_truncation_ignored (str, strlen (HEADER_V1));
+
+  /* ... and the complete lines really were loaded */
+  connections = load_from_string (str->str, str->len - 1);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 1);
+  assert_connection (connections, "gabble/jabber/alice",
+      "gabble/jabber/alice0");
+  g_hash_table_unref (connections);
+
+  g_string_free (str, TRUE);
+}
+
+static void
+test_v2 (void)
+{
+  GString *str = g_string_new (HEADER_V2);
+  GHashTable *connections;
+
+  append_record (str, '+', "gabble/jabber/alice", "gabble/jabber/alice0");
+  append_record (str, '+', "idle/irc/bob", "idle/irc/bob0");
+  append_record (str, '+', "haze/msn/chris", "haze/msn/chris0");
+  /* alice reconnects: her old connection is forgotten */
+  append_record (str, '+', "gabble/jabber/alice2", "gabble/jabber/alice0");
+  /* chris disconnects */
+  append_removal (str, "haze/msn/chris0");
+  /* removing an account with no connection does nothing */
+  append_removal (str, "haze/msn/nobody0");
+
+  connections = load_from_string (str->str, str->len);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 2);
+  assert_connection (connections, "gabble/jabber/alice2",
+      "gabble/jabber/alice0");
+  assert_connection (connections, "idle/irc/bob", "idle/irc/bob0");
+  g_hash_table_unref (connections);
+
+  g_string_free (str, TRUE);
+}
+
+static void
+test_v2_moved (void)
+{
+  GString *str = g_string_new (HEADER_V2);
+  GHashTable *connections;
+
+  /* the same connection is later recorded as belonging to a different
+   * account: it only belongs to the later one */
+  append_record (str, '+', "gabble/jabber/alice", "gabble/jabber/alice0");
+  append_record (str, '+', "gabble/jabber/alice", "gabble/jabber/alice1");
+
+  connections = load_from_string (str->str, str->len);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 1);
+  assert_connection (connections, "gabble/jabber/alice",
+      "gabble/jabber/alice1");
+  g_hash_table_unref (connections);
+
+  /* so the earlier account no longer having a connection doesn't take it
+   * away from the later one */
+  append_removal (str, "gabble/jabber/alice0");
+
+  connections = load_from_string (str->str, str->len);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 1);
+  assert_connection (connections, "gabble/jabber/alice",
+      "gabble/jabber/alice1");
+  g_hash_table_unref (connections);
+
+  /* but the later account no longer having one does */
+  append_removal (str, "gabble/jabber/alice1");
+
+  connections = load_from_string (str->str, str->len);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 0);
+  g_hash_table_unref (connections);
+
+  g_string_free (str, TRUE);
+}
+
+static void
+test_v2_truncated (void)
+{
+  GString *str = g_string_new (HEADER_V2);
+  GHashTable *connections;
+  gsize before_removal;
+
+  append_record (str, '+', "gabble/jabber/alice", "gabble/jabber/alice0");
+  append_record (str, '+', "idle/irc/bob", "idle/irc/bob0");
+  before_removal = str->len;
+  append_removal (str, "gabble/jabber/alice0");
+  append_record (str, '+', "gabble/jabber/alice", "idle/irc/bob0");
+
+  assert_truncation_ignored (str, strlen (HEADER_V2));
+
+  /* a truncated "-" record doesn't remove anything */
+  connections = load_from_string (str->str, before_removal + 5);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 2);
+  assert_connection (connections, "gabble/jabber/alice",
+      "gabble/jabber/alice0");
+  g_hash_table_unref (connections);
+
+  /* and the last "+" record took bob0 away from its old connection */
+  connections = load_from_string (str->str, str->len);
+  g_assert_cmpuint (g_hash_table_size (connections), ==, 1);
+  assert_connection (connections, "gabble/jabber/alice", "idle/irc/bob0");
+  g_hash_table_unref (connections);
+
+  g_string_free (str, TRUE);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_type_init ();
+
+  g_test_add_func ("/account-connections/missing", test_missing);
+  g_test_add_func ("/account-connections/legacy", test_legacy);
+  g_test_add_func ("/account-connections/v1", test_v1);
+  g_test_add_func ("/account-connections/v1-truncated", test_v1_truncated);
+  g_test_add_func ("/account-connections/v2", test_v2);
+  g_test_add_func ("/account-connections/v2-moved", test_v2_moved);
+  g_test_add_func ("/account-connections/v2-truncated", test_v2_truncated);
+
+  return g_test_run ();
+}
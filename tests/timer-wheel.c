@@ -0,0 +1,302 @@
+/* vi: set et sw=4 ts=8 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 8 -*- */
+/*
+ * Regression test for the timer wheel
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <config.h>
+
+/* Yes, this is a hack: it lets us move the wheel's clock by hand, rather
+ * than waiting for real time to pass */
+#include "mcd-timer-wheel.c"
+
+typedef struct {
+  const gchar *name;
+  guint64 tick;
+} Fired;
+
+/* Fired, in the order the timers fired */
+static GArray *fired = NULL;
+
+static void
+setup (void)
+{
+  ensure_wheel ();
+
+  /* every test removes or runs all of its timers, so it's safe to start
+   * again from tick 0 */
+  g_assert_cmpuint (g_hash_table_size (timers), ==, 0);
+  current = 0;
+
+  if (fired == NULL)
+    fired = g_array_new (FALSE, FALSE, sizeof (Fired));
+
+  g_array_set_size (fired, 0);
+}
+
+/* make now_ticks() agree with the wheel's idea of the time, so that
+ * adding a timeout doesn't move the wheel on */
+static void
+freeze_clock (void)
+{
+  base_us = g_get_monotonic_time () - (gint64) current * TICK_MS * 1000;
+}
+
+static gboolean
+log_cb (gpointer data)
+{
+  Fired f = { data, current };
+
+  g_array_append_val (fired, f);
+  return FALSE;
+}
+
+/* add a timeout that is due at exactly @tick */
+static guint
+add_at (guint64 tick,
+    GSourceFunc function,
+    gpointer data)
+{
+  guint id;
+  Timer *timer;
+
+  g_assert_cmpuint (tick, >, current);
+
+  freeze_clock ();
+  id = _mcd_timer_wheel_add (0, 0, function, data);
+  timer = g_hash_table_lookup (timers, GUINT_TO_POINTER (id));
+  g_assert (timer != NULL);
+
+  g_queue_unlink (timer->slot, &timer->link);
+  timer->expires = tick;
+  file_timer (timer, current + 1);
+  return id;
+}
+
+static void
+assert_fired (guint i,
+    const gchar *name,
+    guint64 tick)
+{
+  Fired *f;
+
+  g_assert_cmpuint (i, <, fired->len);
+  f = &g_array_index (fired, Fired, i);
+  g_assert_cmpstr (f->name, ==, name);
+  g_assert_cmpuint (f->tick, ==, tick);
+}
+
+static void
+test_ordering (void)
+{
+  setup ();
+
+  add_at (5, log_cb, "5");
+  add_at (3, log_cb, "3a");
+  add_at (70, log_cb, "70");
+  add_at (3, log_cb, "3b");
+  add_at (4100, log_cb, "4100");
+  add_at (1, log_cb, "1");
+
+  advance (4);
+  g_assert_cmpuint (fired->len, ==, 3);
+  g_assert_cmpuint (current, ==, 4);
+
+  advance (5000);
+  g_assert_cmpuint (fired->len, ==, 6);
+
+  assert_fired (0, "1", 1);
+  /* timeouts due at the same tick fire in the order they were added */
+  assert_fired (1, "3a", 3);
+  assert_fired (2, "3b", 3);
+  assert_fired (3, "5", 5);
+  assert_fired (4, "70", 70);
+  assert_fired (5, "4100", 4100);
+
+  g_assert_cmpuint (g_hash_table_size (timers), ==, 0);
+}
+
+static void
+test_cascade (void)
+{
+  guint64 level1 = (guint64) 1 << SLOT_BITS;
+  guint64 level2 = level1 << SLOT_BITS;
+  guint64 level3 = level2 << SLOT_BITS;
+
+  setup ();
+
+  /* just either side of, and exactly on, the boundary of each level:
+   * a timer that is cascaded down at the tick it's due must fire then,
+   * not a tick later */
+  add_at (level1 - 1, log_cb, "level1 - 1");
+  add_at (level1, log_cb, "level1");
+  add_at (level1 + 1, log_cb, "level1 + 1");
+  add_at (level2 - 1, log_cb, "level2 - 1");
+  add_at (level2, log_cb, "level2");
+  add_at (level2 + 1, log_cb, "level2 + 1");
+  add_at (level3, log_cb, "level3");
+  add_at (level3 + level1, log_cb, "level3 + level1");
+
+  advance (level3 + level2);
+  g_assert_cmpuint (fired->len, ==, 8);
+
+  assert_fired (0, "level1 - 1", level1 - 1);
+  assert_fired (1, "level1", level1);
+  assert_fired (2, "level1 + 1", level1 + 1);
+  assert_fired (3, "level2 - 1", level2 - 1);
+  assert_fired (4, "level2", level2);
+  assert_fired (5, "level2 + 1", level2 + 1);
+  assert_fired (6, "level3", level3);
+  assert_fired (7, "level3 + level1", level3 + level1);
+
+  /* the same, when the timers are added part way through a slot */
+  setup ();
+  current = 100;
+
+  add_at (128, log_cb, "128");
+  add_at (192, log_cb, "192");
+  add_at (level2, log_cb, "level2");
+
+  advance (level2 + 1);
+  g_assert_cmpuint (fired->len, ==, 3);
+
+  assert_fired (0, "128", 128);
+  assert_fired (1, "192", 192);
+  assert_fired (2, "level2", level2);
+
+  g_assert_cmpuint (g_hash_table_size (timers), ==, 0);
+}
+
+static guint self_id = 0;
+static guint victim_id = 0;
+static guint notified = 0;
+
+static gboolean
+remove_cb (gpointer data)
+{
+  log_cb (data);
+
+  g_assert (_mcd_timer_wheel_remove (victim_id));
+  g_assert (_mcd_timer_wheel_remove (self_id));
+
+  /* asking to be called again is ignored, since we removed ourselves */
+  return TRUE;
+}
+
+static void
+notify_cb (gpointer data G_GNUC_UNUSED)
+{
+  notified++;
+}
+
+static void
+test_remove_in_callback (void)
+{
+  Timer *timer;
+  guint later;
+
+  setup ();
+  notified = 0;
+
+  self_id = add_at (10, remove_cb, "remover");
+  timer = g_hash_table_lookup (timers, GUINT_TO_POINTER (self_id));
+  timer->notify = notify_cb;
+
+  /* due at the same tick, but queued after the remover */
+  victim_id = add_at (10, log_cb, "victim");
+  timer = g_hash_table_lookup (timers, GUINT_TO_POINTER (victim_id));
+  timer->notify = notify_cb;
+
+  later = add_at (20, log_cb, "later");
+
+  advance (100);
+
+  g_assert_cmpuint (fired->len, ==, 2);
+  assert_fired (0, "remover", 10);
+  assert_fired (1, "later", 20);
+  g_assert_cmpuint (notified, ==, 2);
+
+  /* they're gone for good */
+  g_assert (!g_hash_table_contains (timers, GUINT_TO_POINTER (self_id)));
+  g_assert (!g_hash_table_contains (timers, GUINT_TO_POINTER (victim_id)));
+  g_assert (!g_hash_table_contains (timers, GUINT_TO_POINTER (later)));
+  g_assert_cmpuint (g_hash_table_size (timers), ==, 0);
+}
+
+static void
+test_slack (void)
+{
+  guint a, b, c;
+  Timer *ta, *tb, *tc;
+  guint64 expires_a, shared;
+
+  setup ();
+
+  /* with no slack, a timeout is due as soon as its delay allows */
+  freeze_clock ();
+  a = _mcd_timer_wheel_add (1000, 0, log_cb, "a");
+  ta = g_hash_table_lookup (timers, GUINT_TO_POINTER (a));
+  g_assert_cmpuint (ta->expires, >=, 1000 / TICK_MS);
+  g_assert_cmpuint (ta->expires, <=, 1000 / TICK_MS + 1);
+
+  /* timeouts with different delays share a tick if their slack allows,
+   * without going off early or later than the slack allows */
+  freeze_clock ();
+  b = _mcd_timer_wheel_add (1000, 640, log_cb, "b");
+  tb = g_hash_table_lookup (timers, GUINT_TO_POINTER (b));
+
+  freeze_clock ();
+  c = _mcd_timer_wheel_add (1100, 640, log_cb, "c");
+  tc = g_hash_table_lookup (timers, GUINT_TO_POINTER (c));
+
+  g_assert_cmpuint (tb->expires, ==, tc->expires);
+  g_assert_cmpuint (tb->expires, >=, 1000 / TICK_MS);
+  g_assert_cmpuint (tb->expires, <=, (1000 + 640) / TICK_MS + 1);
+  g_assert_cmpuint (tc->expires, >=, 1100 / TICK_MS);
+  g_assert_cmpuint (tc->expires, <=, (1100 + 640) / TICK_MS + 1);
+
+  expires_a = ta->expires;
+  shared = tb->expires;
+  g_assert_cmpuint (shared, >, expires_a);
+
+  advance (shared);
+  g_assert_cmpuint (fired->len, ==, 3);
+  assert_fired (0, "a", expires_a);
+  assert_fired (1, "b", shared);
+  assert_fired (2, "c", shared);
+
+  g_assert_cmpuint (g_hash_table_size (timers), ==, 0);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/timer-wheel/ordering", test_ordering);
+  g_test_add_func ("/timer-wheel/cascade", test_cascade);
+  g_test_add_func ("/timer-wheel/remove-in-callback",
+      test_remove_in_callback);
+  g_test_add_func ("/timer-wheel/slack", test_slack);
+
+  return g_test_run ();
+}
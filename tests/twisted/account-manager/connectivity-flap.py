@@ -0,0 +1,86 @@
+# Copyright (C) 2026 agent <agent@local>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for ignoring the network when it goes away and comes
+straight back.
+"""
+
+import time
+
+import dbus
+
+from servicetest import EventPattern, sync_dbus
+from mctest import (
+    exec_test, create_fakecm_account, enable_fakecm_account, MC,
+)
+import constants as cs
+
+# Must be comfortably longer than it takes us to turn the network off and
+# on again, and comfortably shorter than the event queue's timeout
+HYSTERESIS_MS = 1000
+
+def sync_connectivity_state(mc):
+    # See connectivity.py
+    mc.BillyIdle(dbus_interface='org.freedesktop.Telepathy.MissionControl5.RegressionTests')
+
+def test(q, bus, unused, **kwargs):
+    # MC hasn't been started yet, so it will be started with these
+    bus_daemon = dbus.Interface(bus.get_object(dbus.BUS_DAEMON_NAME,
+        dbus.BUS_DAEMON_PATH), dbus.BUS_DAEMON_IFACE)
+    bus_daemon.UpdateActivationEnvironment(dbus.Dictionary({
+        'MC_CONNECTIVITY_HYSTERESIS': str(HYSTERESIS_MS),
+        'MC_CONNECTIVITY_MIN_INTERVAL': '0',
+        }, signature='ss'))
+
+    mc = MC(q, bus)
+
+    params = dbus.Dictionary(
+        {"account": "someguy@example.com",
+         "password": "secrecy",
+        }, signature='sv')
+    (simulated_cm, account) = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    # A blip that is over before the hysteresis period ends should go
+    # unnoticed.
+    disconnect_event = [
+        EventPattern('dbus-method-call', method='Disconnect'),
+        EventPattern('dbus-method-call', method='RequestConnection'),
+    ]
+    q.forbid_events(disconnect_event)
+
+    mc.connectivity.go_offline()
+    sync_connectivity_state(mc)
+    mc.connectivity.go_online()
+    sync_connectivity_state(mc)
+
+    # Wait until MC would have acted on the blip, if it was going to.
+    time.sleep(2 * HYSTERESIS_MS / 1000.0)
+    sync_connectivity_state(mc)
+    sync_dbus(bus, q, mc)
+
+    assert account.Properties.Get(cs.ACCOUNT, 'Connection') == \
+        conn.object_path
+    q.unforbid_events(disconnect_event)
+
+    # If the network stays away, the connection should be banished once
+    # the hysteresis period has passed.
+    mc.connectivity.go_offline()
+    q.expect('dbus-method-call', method='Disconnect')
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False)
@@ -0,0 +1,177 @@
+# Copyright (C) 2026 agent <agent@local>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for picking up the handled channels left behind by a
+previous MC instance.
+"""
+
+import os
+import time
+
+import dbus
+
+from servicetest import EventPattern, sync_dbus
+from mctest import exec_test, SimulatedConnection, SimulatedClient, \
+        SimulatedChannel, MC
+import constants as cs
+
+account_id = 'fakecm/fakeprotocol/jc_2edenton_40unatco_2eint'
+
+# How long MC gives the channels in the snapshot to be confirmed: much
+# shorter than the default, so we don't have to wait long
+CONFIRM_TIMEOUT_MS = 2000
+
+def preseed(q, bus, fake_accounts_service):
+    accounts_dir = os.environ['MC_ACCOUNT_DIR']
+
+    try:
+        os.mkdir(accounts_dir, 0700)
+    except OSError:
+        pass
+
+    fake_accounts_service.update_attributes(account_id, changed={
+        'manager': 'fakecm',
+        'protocol': 'fakeprotocol',
+        'DisplayName': 'Work account',
+        'NormalizedName': 'jc.denton@unatco.int',
+        'Enabled': True,
+        })
+    fake_accounts_service.update_parameters(account_id, untyped={
+        'account': 'jc.denton@unatco.int',
+        'password': 'ionstorm',
+        })
+
+    account_connections_file = open(accounts_dir + '/.mc_connections', 'w')
+
+    account_connections_file.write("%s\t%s\t%s\n" %
+            (cs.tp_path_prefix + '/Connection/fakecm/fakeprotocol/jc',
+                cs.tp_name_prefix + '.Connection.fakecm.fakeprotocol.jc',
+                account_id))
+    account_connections_file.close()
+
+def read_snapshot(path):
+    try:
+        f = open(path)
+    except IOError:
+        return set()
+
+    paths = set([line.split('\t')[0] for line in f if line.strip()])
+    f.close()
+    return paths
+
+def test(q, bus, unused, **kwargs):
+    fake_accounts_service = kwargs['fake_accounts_service']
+    preseed(q, bus, fake_accounts_service)
+
+    # MC hasn't been started yet, so it will be started with this
+    bus_daemon = dbus.Interface(bus.get_object(dbus.BUS_DAEMON_NAME,
+        dbus.BUS_DAEMON_PATH), dbus.BUS_DAEMON_IFACE)
+    bus_daemon.UpdateActivationEnvironment(dbus.Dictionary({
+        'MC_SNAPSHOT_CONFIRM_TIMEOUT': str(CONFIRM_TIMEOUT_MS),
+        }, signature='ss'))
+
+    text_fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+
+    conn = SimulatedConnection(q, bus, 'fakecm', 'fakeprotocol',
+            'jc', 'jc.denton@unatco.int')
+    conn.StatusChanged(cs.CONN_STATUS_CONNECTED, 0)
+
+    live_properties = dbus.Dictionary(text_fixed_properties, signature='sv')
+    live_properties[cs.CHANNEL + '.Interfaces'] = dbus.Array(signature='s')
+    live_properties[cs.CHANNEL + '.TargetID'] = 'anna.navarre@unatco.int'
+    live_properties[cs.CHANNEL + '.TargetHandle'] = \
+            dbus.UInt32(conn.ensure_handle(cs.HT_CONTACT,
+                'anna.navarre@unatco.int'))
+    live_properties[cs.CHANNEL + '.InitiatorHandle'] = \
+            dbus.UInt32(conn.self_handle)
+    live_properties[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    live_properties[cs.CHANNEL + '.Requested'] = True
+    live_chan = SimulatedChannel(conn, live_properties)
+    live_chan.announce()
+
+    # This one closed while MC wasn't running
+    closed_path = conn.object_path + '/ClosedChannel'
+
+    # Both are handled by a process that is not a Client, so it will never
+    # tell MC its HandledChannels
+    handler = dbus.bus.BusConnection()
+
+    # A Client that would be asked to handle the live channel if MC didn't
+    # know it was already being handled
+    client = SimulatedClient(q, bus, 'Empathy',
+            observe=[text_fixed_properties], approve=[text_fixed_properties],
+            handle=[text_fixed_properties], bypass_approval=False)
+
+    snapshot_dir = os.path.join(os.environ['XDG_RUNTIME_DIR'], 'telepathy',
+            'mission-control')
+    os.makedirs(snapshot_dir, 0700)
+    snapshot_path = os.path.join(snapshot_dir,
+            'handled-channels-' + bus_daemon.GetId())
+
+    snapshot = open(snapshot_path, 'w')
+
+    for path in (live_chan.object_path, closed_path):
+        snapshot.write('%s\t%s\t\t%s\n' % (path, handler.get_unique_name(),
+            cs.ACCOUNT_PATH_PREFIX + account_id))
+
+    snapshot.close()
+
+    # Left over from a bus that has gone away
+    other_bus_path = os.path.join(snapshot_dir,
+            'handled-channels-0123456789abcdef0123456789abcdef')
+    other_bus = open(other_bus_path, 'w')
+    other_bus.write('%s\t:1.42\t\t\n' % live_chan.object_path)
+    other_bus.close()
+
+    # The live channel is already being handled, so nobody is asked to
+    # handle or approve it
+    forbidden = [
+        EventPattern('dbus-method-call', method='HandleChannels'),
+        EventPattern('dbus-method-call', method='AddDispatchOperation'),
+        ]
+    q.forbid_events(forbidden)
+
+    # Service-activate MC
+    mc = MC(q, bus, wait_for_names=False)
+    mc.wait_for_names()
+
+    # The closed channel is forgotten once MC has given up waiting for
+    # someone to confirm it, but the live channel is remembered, since MC
+    # has seen it on its connection
+    deadline = time.time() + 10 * CONFIRM_TIMEOUT_MS / 1000.0
+
+    while read_snapshot(snapshot_path) != set([live_chan.object_path]):
+        assert time.time() < deadline, read_snapshot(snapshot_path)
+        time.sleep(0.1)
+        sync_dbus(bus, q, mc)
+
+    assert not os.path.exists(other_bus_path)
+
+    # MC really does think the live channel belongs to the other process:
+    # when it exits, the channel is closed
+    handler.close()
+    q.expect('dbus-method-call', path=live_chan.object_path,
+            interface=cs.CHANNEL, method='Close')
+
+    q.unforbid_events(forbidden)
+
+if __name__ == '__main__':
+    exec_test(test, {}, preload_mc=False, use_fake_accounts_service=True,
+            pass_kwargs=True)
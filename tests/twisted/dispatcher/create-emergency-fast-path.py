@@ -0,0 +1,147 @@
+# Copyright (C) 2026 agent <agent@local>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for emergency calls skipping the policy plugins on
+their way to the CM and to the handler.
+"""
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern, call_async, sync_dbus
+from mctest import exec_test, SimulatedClient, SimulatedChannel, \
+        create_fakecm_account, enable_fakecm_account, expect_client_setup
+import constants as cs
+
+# Delayed by the request policy plugin, unless it's an emergency call
+DELAYED_CTYPE = 'com.example.QuestionableChannel'
+
+# Delayed by the dispatch operation policy plugin, unless it's an emergency
+# call; here, it's also an emergency service point
+EMERGENCY_ID = 'policy@example.net'
+
+def test(q, bus, mc):
+    policy_bus_name_ref = dbus.service.BusName('com.example.Policy', bus)
+
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    conn, e = enable_fakecm_account(q, bus, mc, account, params,
+            extra_interfaces=[cs.CONN_IFACE_SERVICE_POINT],
+            expect_after_connect=[
+                EventPattern('dbus-method-call', method='Get',
+                    args=[cs.CONN_IFACE_SERVICE_POINT, 'KnownServicePoints']),
+                ])
+
+    points = dbus.Array([((cs.SERVICE_POINT_TYPE_EMERGENCY, 'urn:service:sos'),
+                          ['911', '112', EMERGENCY_ID])],
+                        signature='((us)as)')
+    q.dbus_return(e.message, points, signature='v')
+
+    fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': DELAYED_CTYPE,
+        }, signature='sv')
+
+    # Both can handle the call, but the dialler's filter is more specific,
+    # so MC should choose it
+    empathy = SimulatedClient(q, bus, 'Empathy',
+            handle=[fixed_properties], request_notification=False)
+
+    dialler_filter = dbus.Dictionary(fixed_properties, signature='sv')
+    dialler_filter[cs.CHANNEL + '.TargetID'] = EMERGENCY_ID
+    dialler = SimulatedClient(q, bus, 'Dialler',
+            handle=[dialler_filter], request_notification=False)
+
+    # wait for MC to download the properties
+    expect_client_setup(q, [empathy, dialler])
+
+    user_action_time = dbus.Int64(1238582606)
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+
+    # Neither the request policy nor the dispatch operation policy should
+    # be consulted for an emergency call, and the handler that MC chose
+    # when the request was made is the only one that should be tried
+    forbidden = [
+            EventPattern('dbus-method-call', method='RequestRequest'),
+            EventPattern('dbus-method-call', method='RequestPermission'),
+            EventPattern('dbus-method-call', method='HandleChannels',
+                path=empathy.object_path),
+            ]
+    q.forbid_events(forbidden)
+
+    request = dbus.Dictionary({
+            cs.CHANNEL + '.ChannelType': DELAYED_CTYPE,
+            cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+            cs.CHANNEL + '.TargetID': EMERGENCY_ID,
+            }, signature='sv')
+
+    # no preferred handler: MC has to pick one for us
+    call_async(q, cd, 'CreateChannel',
+            account.object_path, request, user_action_time, '',
+            dbus_interface=cs.CD)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    request_path = ret.value[0]
+
+    cr = bus.get_object(cs.AM, request_path)
+    call_async(q, cr, 'Proceed', dbus_interface=cs.CR)
+
+    cm_request_call, _ = q.expect_many(
+            EventPattern('dbus-method-call',
+                interface=cs.CONN_IFACE_REQUESTS, method='CreateChannel',
+                path=conn.object_path, args=[request], handled=False),
+            EventPattern('dbus-return', method='Proceed'),
+            )
+
+    channel_immutable = dbus.Dictionary(request)
+    channel_immutable[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    channel_immutable[cs.CHANNEL + '.InitiatorHandle'] = conn.self_handle
+    channel_immutable[cs.CHANNEL + '.Requested'] = True
+    channel_immutable[cs.CHANNEL + '.Interfaces'] = \
+        dbus.Array([], signature='s')
+    channel_immutable[cs.CHANNEL + '.TargetHandle'] = \
+        conn.ensure_handle(cs.HT_CONTACT, EMERGENCY_ID)
+    channel = SimulatedChannel(conn, channel_immutable)
+
+    q.dbus_return(cm_request_call.message,
+            channel.object_path, channel.immutable, signature='oa{sv}')
+    channel.announce()
+
+    # The plugin still gets to check that the handler is acceptable
+    e = q.expect('dbus-method-call',
+            interface='com.example.Policy', method='CheckHandler')
+    q.dbus_return(e.message, signature='')
+
+    e = q.expect('dbus-method-call',
+            path=dialler.object_path,
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    assert e.args[2][0][0] == channel.object_path, e.args
+    assert e.args[3] == [request_path], e.args
+    q.dbus_return(e.message, signature='')
+
+    q.expect('dbus-signal', path=request_path, interface=cs.CR,
+            signal='Succeeded')
+
+    channel.close()
+
+    sync_dbus(bus, q, account)
+    q.unforbid_events(forbidden)
+
+if __name__ == '__main__':
+    exec_test(test, {})
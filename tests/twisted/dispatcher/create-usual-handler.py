@@ -0,0 +1,119 @@
+# Copyright (C) 2026 agent <agent@local>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+# 02110-1301 USA
+
+"""Regression test for ChannelDispatcher preferring, among equally good
+Handlers, the one that took the last similar channel.
+"""
+
+import dbus
+import dbus.service
+
+from servicetest import EventPattern, call_async
+from mctest import exec_test, SimulatedClient, SimulatedChannel, \
+        create_fakecm_account, enable_fakecm_account, expect_client_setup
+import constants as cs
+
+def test(q, bus, mc):
+    params = dbus.Dictionary({"account": "someguy@example.com",
+        "password": "secrecy"}, signature='sv')
+    simulated_cm, account = create_fakecm_account(q, bus, mc, params)
+    conn = enable_fakecm_account(q, bus, mc, account, params)
+
+    text_fixed_properties = dbus.Dictionary({
+        cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+        cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+        }, signature='sv')
+
+    # two Handlers that are equally good
+    empathy = SimulatedClient(q, bus, 'Empathy',
+            handle=[text_fixed_properties])
+    kopete = SimulatedClient(q, bus, 'Kopete',
+            handle=[text_fixed_properties])
+
+    # wait for MC to download the properties
+    expect_client_setup(q, [empathy, kopete])
+
+    # Whichever Handler the user chose last time is predicted, and used,
+    # when they don't express a preference
+    for preferred, expected in ((kopete, kopete), (None, kopete),
+            (empathy, empathy), (None, empathy)):
+        create_and_handle(q, bus, account, conn, preferred, expected)
+
+def create_and_handle(q, bus, account, conn, preferred, expected):
+    user_action_time = dbus.Int64(1238582606)
+
+    cd = bus.get_object(cs.CD, cs.CD_PATH)
+
+    request = dbus.Dictionary({
+            cs.CHANNEL + '.ChannelType': cs.CHANNEL_TYPE_TEXT,
+            cs.CHANNEL + '.TargetHandleType': cs.HT_CONTACT,
+            cs.CHANNEL + '.TargetID': 'juliet',
+            }, signature='sv')
+    call_async(q, cd, 'CreateChannel',
+            account.object_path, request, user_action_time,
+            preferred is not None and preferred.bus_name or '',
+            dbus_interface=cs.CD)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    request_path = ret.value[0]
+
+    cr = bus.get_object(cs.AM, request_path)
+    cr.Proceed(dbus_interface=cs.CR)
+
+    cm_request_call, add_request_call = q.expect_many(
+            EventPattern('dbus-method-call',
+                interface=cs.CONN_IFACE_REQUESTS, method='CreateChannel',
+                path=conn.object_path, args=[request], handled=False),
+            EventPattern('dbus-method-call', handled=False,
+                interface=cs.CLIENT_IFACE_REQUESTS, method='AddRequest'),
+            )
+
+    # the expected Handler is told about the request in advance, and so can
+    # get ready for it while the connection is creating the channel
+    assert add_request_call.path == expected.object_path, \
+            (add_request_call.path, expected.object_path)
+    assert add_request_call.args[0] == request_path
+    q.dbus_return(add_request_call.message, signature='')
+
+    channel_immutable = dbus.Dictionary(request)
+    channel_immutable[cs.CHANNEL + '.InitiatorID'] = conn.self_ident
+    channel_immutable[cs.CHANNEL + '.InitiatorHandle'] = conn.self_handle
+    channel_immutable[cs.CHANNEL + '.Requested'] = True
+    channel_immutable[cs.CHANNEL + '.Interfaces'] = \
+        dbus.Array([], signature='s')
+    channel_immutable[cs.CHANNEL + '.TargetHandle'] = \
+        conn.ensure_handle(cs.HT_CONTACT, 'juliet')
+    channel = SimulatedChannel(conn, channel_immutable)
+
+    q.dbus_return(cm_request_call.message,
+            channel.object_path, channel.immutable, signature='oa{sv}')
+    channel.announce()
+
+    e = q.expect('dbus-method-call',
+            interface=cs.HANDLER, method='HandleChannels',
+            handled=False)
+    assert e.path == expected.object_path, (e.path, expected.object_path)
+    assert e.args[2][0][0] == channel.object_path, e.args
+    assert e.args[3] == [request_path], e.args
+    q.dbus_return(e.message, signature='')
+
+    q.expect('dbus-signal', path=request_path, interface=cs.CR,
+            signal='Succeeded')
+
+    channel.close()
+
+if __name__ == '__main__':
+    exec_test(test, {})
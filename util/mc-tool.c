@@ -62,6 +62,7 @@ show_help (gchar * err)
 	    "    %1$s auto-connect <account name> [(on|off)]\n"
 	    "    %1$s reconnect <account name>\n"
 	    "    %1$s remove <account name>\n"
+	    "    %1$s dispatch-stats [reset]\n"
 	    "  where <param> matches (int|uint|bool|string|path):<key>=<value>\n",
 	    app_name);
 
@@ -844,6 +845,96 @@ command_dump (TpAccountManager *manager)
     return FALSE; /* stop mainloop */
 }
 
+#define DISPATCH_STATS_BUS_NAME "org.freedesktop.Telepathy.MissionControl5"
+#define DISPATCH_STATS_OBJECT_PATH \
+    "/org/freedesktop/Telepathy/MissionControl5/DispatchStats"
+#define DISPATCH_STATS_IFACE \
+    "org.freedesktop.Telepathy.MissionControl5.Debug.DispatchStats"
+
+static gboolean
+command_dispatch_stats (TpAccountManager *manager G_GNUC_UNUSED)
+{
+    GDBusConnection *bus;
+    GVariant *reply;
+    GVariantIter *bounds_iter, *stages_iter, *buckets_iter;
+    GError *error = NULL;
+    GArray *bounds;
+    const gchar *stage;
+    guint64 count, total, max, bound;
+    guint32 n;
+    guint i;
+
+    bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+    if (bus == NULL)
+	goto error;
+
+    if (command.boolean.value) {
+	reply = g_dbus_connection_call_sync (bus, DISPATCH_STATS_BUS_NAME,
+	    DISPATCH_STATS_OBJECT_PATH, DISPATCH_STATS_IFACE, "Reset",
+	    NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+	if (reply == NULL)
+	    goto error;
+
+	g_variant_unref (reply);
+	g_object_unref (bus);
+	command.common.ret = 0;
+	return FALSE;
+    }
+
+    reply = g_dbus_connection_call_sync (bus, DISPATCH_STATS_BUS_NAME,
+	DISPATCH_STATS_OBJECT_PATH, DISPATCH_STATS_IFACE, "GetHistograms",
+	NULL, G_VARIANT_TYPE ("(ata(stttau))"), G_DBUS_CALL_FLAGS_NONE, -1,
+	NULL, &error);
+    if (reply == NULL)
+	goto error;
+
+    command.common.ret = 0;
+
+    g_variant_get (reply, "(ata(stttau))", &bounds_iter, &stages_iter);
+
+    bounds = g_array_new (FALSE, FALSE, sizeof (guint64));
+    while (g_variant_iter_next (bounds_iter, "t", &bound))
+	g_array_append_val (bounds, bound);
+
+    while (g_variant_iter_next (stages_iter, "(&stttau)", &stage, &count,
+				&total, &max, &buckets_iter)) {
+	printf ("%-18s count: %-8" G_GUINT64_FORMAT, stage, count);
+
+	if (count > 0)
+	    printf (" mean: %.1fms max: %.1fms",
+		    (total / (gdouble) count) / 1000.0, max / 1000.0);
+
+	printf ("\n");
+
+	for (i = 0; g_variant_iter_next (buckets_iter, "u", &n); i++) {
+	    if (n == 0)
+		continue;
+
+	    if (i < bounds->len)
+		printf ("    < %6" G_GUINT64_FORMAT "ms: %u\n",
+			g_array_index (bounds, guint64, i) / 1000, n);
+	    else
+		printf ("    slower:    %u\n", n);
+	}
+
+	g_variant_iter_free (buckets_iter);
+    }
+
+    g_array_unref (bounds);
+    g_variant_iter_free (bounds_iter);
+    g_variant_iter_free (stages_iter);
+    g_variant_unref (reply);
+    g_object_unref (bus);
+    return FALSE; /* stop mainloop */
+
+error:
+    fprintf (stderr, "%s %s: %s\n", app_name, command.common.name,
+	     error->message);
+    g_error_free (error);
+    g_clear_object (&bus);
+    return FALSE;
+}
+
 static gboolean
 command_connection (TpAccount *account)
 {
@@ -1364,6 +1455,16 @@ parse (int argc, char **argv)
         command.ready.account = command_reconnect;
         command.common.account = argv[2];
     }
+    else if (strcmp (argv[1], "dispatch-stats") == 0)
+    {
+        /* Show or reset dispatch latency histograms */
+        if (argc == 3 && strcmp (argv[2], "reset") == 0)
+            command.boolean.value = TRUE;
+        else if (argc != 2)
+            show_help ("Invalid dispatch-stats command.");
+
+        command.ready.manager = command_dispatch_stats;
+    }
     else if (strcmp (argv[1], "help") == 0
 	     || strcmp (argv[1], "-h") == 0 || strcmp (argv[1], "--help") == 0)
     {